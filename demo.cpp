@@ -1,5 +1,6 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <util/delay.h>
 
 #include <stdio.h>
@@ -7,8 +8,8 @@
 /**
 	This is a demo for the vt100 functionality. 
 
-	To do the tests, you may have to comment out some of them because all
-	the strings take up a lot of ram. :)
+	The test strings are kept in flash (PSTR, vt100_puts_P) because the
+	terminal's cell grid takes most of the ram.
 	
 	Copyright: Martin K. Schröder (info@fortmax.se) 2014/10/27
 */
@@ -22,6 +23,40 @@
 #include "ili9340.h"
 #include "vt100.h"
 
+// the screen is redrawn at least every 40ms while output keeps coming in
+#define FRAME_TICKS (F_CPU / 1024 / 25)
+
+#define UART_BAUD 38400UL
+// longest time in ms the main loop goes without reading the uart: a flush
+// step (about 2ms) after a vt100_write
+#define READ_GAP_MS 3
+// bytes that arrive in that time (10 bits per byte)
+#define READ_GAP_BYTES (UART_BAUD / 10 * READ_GAP_MS / 1000 + 1)
+// uart backlog above which drawing is postponed in favor of parsing. The
+// rest of the buffer takes what arrives while the last step is drawn
+#define BACKLOG_LIMIT (UART_RX_BUFFER_SIZE - READ_GAP_BYTES)
+#if READ_GAP_BYTES * 2 > UART_RX_BUFFER_SIZE
+#error "UART_RX_BUFFER_SIZE is too small for UART_BAUD (see README)"
+#endif
+
+// stack check: the ram between the variables and the top of the stack is
+// filled with a pattern before main runs (.init1), and _stack_unused counts
+// the bytes at the bottom that still hold it, the ones the stack has never
+// reached. The demo sends the count after its tests (see main)
+#define STACK_PAINT 0xc5
+extern "C" uint8_t _end, __stack;
+
+extern "C" void _stack_paint(void) __attribute__((naked, used, section(".init1")));
+void _stack_paint(void){
+	for(uint8_t *p = &_end; p <= &__stack; p++) *p = STACK_PAINT;
+}
+
+static uint16_t _stack_unused(void){
+	uint16_t n = 0;
+	for(const uint8_t *p = &_end; p <= &__stack && *p == STACK_PAINT; p++) n++;
+	return n;
+}
+
 /**
   Tests following commands:
 
@@ -63,7 +98,7 @@
 void test_cursor(){
 	char buf[16]; 
 	// clear screen
-	vt100_puts("\e[c\e[2J\e[m\e[r\e[?6l\e[1;1H");
+	vt100_puts_P(PSTR("\e[c\e[2J\e[m\e[r\e[?6l\e[1;1H"));
 
 	// draw a line of "*"
 	for(int c = 0; c < VT100_WIDTH; c++){
@@ -71,28 +106,28 @@ void test_cursor(){
 	}
 	// draw left and right border
 	for(int c = 0; c < VT100_HEIGHT; c++){
-		sprintf(buf, "\e[%d;1H*\e[%d;%dH*", c + 1, c + 1, VT100_WIDTH);
+		sprintf_P(buf, PSTR("\e[%d;1H*\e[%d;%dH*"), c + 1, c + 1, VT100_WIDTH);
 		vt100_puts(buf);
 	}
 	// draw bottom line
-	sprintf(buf, "\e[%d;1H", VT100_HEIGHT);
+	sprintf_P(buf, PSTR("\e[%d;1H"), VT100_HEIGHT);
 	vt100_puts(buf); 
 	for(int c = 0; c < VT100_WIDTH; c++){
 		vt100_putc('*');
 	}
 	// draw inner border of +
-	vt100_puts("\e[2;2H");
+	vt100_puts_P(PSTR("\e[2;2H"));
 	// draw a line of "*"
 	for(int c = 0; c < VT100_WIDTH - 2; c++){
 		vt100_putc('+'); 
 	}
 	// draw left and right border
 	for(int c = 1; c < VT100_HEIGHT - 1; c++){
-		sprintf(buf, "\e[%d;2H+\e[%d;%dH+", c + 1, c + 1, VT100_WIDTH - 1);
+		sprintf_P(buf, PSTR("\e[%d;2H+\e[%d;%dH+"), c + 1, c + 1, VT100_WIDTH - 1);
 		vt100_puts(buf);
 	}
 	// draw bottom line
-	sprintf(buf, "\e[%d;2H", VT100_HEIGHT - 1);
+	sprintf_P(buf, PSTR("\e[%d;2H"), VT100_HEIGHT - 1);
 	vt100_puts(buf); 
 	for(int c = 0; c < VT100_WIDTH - 2; c++){
 		vt100_putc('+');
@@ -106,39 +141,39 @@ void test_cursor(){
 	// E rder around the text.      E
 	// E                            E
 	// EEEEEEEEEEEEEEEEEEEEEEEEEEEEEE
-	vt100_puts("\e[10;6H");
+	vt100_puts_P(PSTR("\e[10;6H"));
 	for(int c = 0; c < 30; c++){
 		vt100_putc('E');
 	}
 	// test normal movement
-	vt100_puts("\e[11;6H");
+	vt100_puts_P(PSTR("\e[11;6H"));
 	// test cursor store and restore...
-	vt100_puts("\e7\e[35;10H\e8");
-	vt100_puts("E\e[11;35HE");
+	vt100_puts_P(PSTR("\e7\e[35;10H\e8"));
+	vt100_puts_P(PSTR("E\e[11;35HE"));
 	// goto 12;6, print E, move cursor 29 (already moved +1) to right and print E
-	vt100_puts("\e[12;6HE\e[28CE");
+	vt100_puts_P(PSTR("\e[12;6HE\e[28CE"));
 	// move cursor 31 to left, 1 down, print E, move 30 right, print E
-	vt100_puts("\e[30D\e[BE\e[28CE");
-	vt100_puts("\e[15;6H\e[AE\e[28CE");
-	vt100_puts("\e[15;6HE\e[15;35HE"); 
+	vt100_puts_P(PSTR("\e[30D\e[BE\e[28CE"));
+	vt100_puts_P(PSTR("\e[15;6H\e[AE\e[28CE"));
+	vt100_puts_P(PSTR("\e[15;6HE\e[15;35HE")); 
 	
-	vt100_puts("\e[16;6H");
+	vt100_puts_P(PSTR("\e[16;6H"));
 	for(int c = 0; c < 30; c++){
 		vt100_putc('E');
 	}
 
-	const char *text[] = {"This must be an unbroken a", "rea of text with 1 free bo", "rder around the text.     "};
+	static const char text[][27] PROGMEM = {"This must be an unbroken a", "rea of text with 1 free bo", "rder around the text.     "};
 	for(int c = 0; c < 3; c++){
-		sprintf(buf, "\e[%d;8H", c + 12);
+		sprintf_P(buf, PSTR("\e[%d;8H"), c + 12);
 		vt100_puts(buf);
-		vt100_puts(text[c]);
+		vt100_puts_P(text[c]);
 	}
 
 	// now lets draw two parallel columns of Es
-	vt100_puts("\e[20;19H"); 
+	vt100_puts_P(PSTR("\e[20;19H")); 
 	for(int c = 0; c < 10; c++){
 		// draw E (cursor moves right), step one right, draw F, step 3 left and 1 down
-		vt100_puts("E\e[1CF\e[3D\e[B");
+		vt100_puts_P(PSTR("E\e[1CF\e[3D\e[B"));
 	}
 	
 	// Test index (escD - down with scroll)
@@ -147,20 +182,20 @@ void test_cursor(){
 	// save and restore cursor
 
 	// move to last line and scroll down 8 lines
-	vt100_puts("\e[40;1H");
+	vt100_puts_P(PSTR("\e[40;1H"));
 	for(int c = 0; c < 7; c++){
-		vt100_puts("\eD");
+		vt100_puts_P(PSTR("\eD"));
 	}
 	_delay_ms(100); 
 	// now scroll same number of lines back and then back again (to test up scroll)
-	vt100_puts("\e[1;1H");
+	vt100_puts_P(PSTR("\e[1;1H"));
 	for(int c = 0; c < 7; c++){
-		vt100_puts("\eM");
+		vt100_puts_P(PSTR("\eM"));
 	}
 	_delay_ms(100); 
-	vt100_puts("\e[40;1H");
+	vt100_puts_P(PSTR("\e[40;1H"));
 	for(int c = 0; c < 7; c++){
-		vt100_puts("\eD");
+		vt100_puts_P(PSTR("\eD"));
 	}
 	
 	// we now have the Es at the third line (or we SHOULD have)
@@ -168,30 +203,30 @@ void test_cursor(){
 	for(int c = 1; c < VT100_WIDTH - 1; c++){
 		// we print * then move down and left, print + and go back right and top
 		// (good way to test cursor navigation keys)
-		sprintf(buf, "\e[1;%dH*\e[B\e[D+\e[A", c + 1); 
+		sprintf_P(buf, PSTR("\e[1;%dH*\e[B\e[D+\e[A"), c + 1); 
 		vt100_puts(buf);
 	}
 	// clear the border that scrolled up
 	for(int c = 2; c < VT100_WIDTH - 2; c++){
 		// space, down, left, space, up
-		sprintf(buf, "\e[32;%dH \e[B\e[D \e[A", c + 1); 
+		sprintf_P(buf, PSTR("\e[32;%dH \e[B\e[D \e[A"), c + 1); 
 		vt100_puts(buf);
 	}
 	
 	// redraw left and right border
 	for(int c = 1; c < VT100_HEIGHT; c++){
-		sprintf(buf, "\e[%d;1H*+\e[%d;%dH+*", c + 1, c + 1, VT100_WIDTH - 1);
+		sprintf_P(buf, PSTR("\e[%d;1H*+\e[%d;%dH+*"), c + 1, c + 1, VT100_WIDTH - 1);
 		vt100_puts(buf);
 	}
 	
 	// fill border at the bottom
 	for(int c = 1; c < VT100_WIDTH - 1; c++){
-		sprintf(buf, "\e[39;%dH+\e[B\e[D*\e[A", c + 1); 
+		sprintf_P(buf, PSTR("\e[39;%dH+\e[B\e[D*\e[A"), c + 1); 
 		vt100_puts(buf);
 	}
 	// draw the explanation string
-	vt100_puts("\e[30;6HShould see two columns of E F"); 
-	vt100_puts("\e[31;6HText box must start at line 3"); 
+	vt100_puts_P(PSTR("\e[30;6HShould see two columns of E F")); 
+	vt100_puts_P(PSTR("\e[31;6HText box must start at line 3")); 
 }
 
 /**
@@ -202,32 +237,32 @@ void test_cursor(){
 void test_scroll(){
 	char buf[16]; 
 	// reset terminal and clear screen. Cursor at 1;1. 
-	vt100_puts("\e[c\e[2J\e[m\e[r\e[?6l\e[1;1H");
+	vt100_puts_P(PSTR("\e[c\e[2J\e[m\e[r\e[?6l\e[1;1H"));
 
 	// set top margin 3 lines, bottom margin 5 lines
-	vt100_puts("\e[4;36r");
+	vt100_puts_P(PSTR("\e[4;35r"));
 
 	// draw top and bottom windows
-	vt100_puts("\e[1;1H#\e[2;1H#\e[3;1H#\e[1;40H#\e[2;40H#\e[3;40H#");
-	vt100_puts("\e[36;1H#\e[37;1H#\e[38;1H#\e[39;1H#\e[40;1H#");
-	vt100_puts("\e[36;40H#\e[37;40H#\e[38;40H#\e[39;40H#\e[40;40H#");
-	vt100_puts("\e[1;1H"); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#'); 
-	vt100_puts("\e[3;1H"); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#'); 
-	vt100_puts("\e[36;1H"); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#'); 
-	vt100_puts("\e[40;1H"); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#');
+	vt100_puts_P(PSTR("\e[1;1H#\e[2;1H#\e[3;1H#\e[1;40H#\e[2;40H#\e[3;40H#"));
+	vt100_puts_P(PSTR("\e[36;1H#\e[37;1H#\e[38;1H#\e[39;1H#\e[40;1H#"));
+	vt100_puts_P(PSTR("\e[36;40H#\e[37;40H#\e[38;40H#\e[39;40H#\e[40;40H#"));
+	vt100_puts_P(PSTR("\e[1;1H")); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#'); 
+	vt100_puts_P(PSTR("\e[3;1H")); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#'); 
+	vt100_puts_P(PSTR("\e[36;1H")); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#'); 
+	vt100_puts_P(PSTR("\e[40;1H")); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#');
 
 	// print some text that should not move
-	vt100_puts("\e[2;4HThis is top text (should not move)"); 
-	vt100_puts("\e[38;3HThis is bottom text (should not move)");
+	vt100_puts_P(PSTR("\e[2;4HThis is top text (should not move)")); 
+	vt100_puts_P(PSTR("\e[38;3HThis is bottom text (should not move)"));
 	
 	// set origin mode and print border around the scroll region
-	vt100_puts("\e[?6h");
-	vt100_puts("\e[1;1H"); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('!');
+	vt100_puts_P(PSTR("\e[?6h"));
+	vt100_puts_P(PSTR("\e[1;1H")); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('!');
 	// origin mode should snap 99 to last line in scroll region
-	vt100_puts("\e[99;1H"); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('!');
+	vt100_puts_P(PSTR("\e[99;1H")); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('!');
 	for(int y = 0; y < VT100_HEIGHT; y++){
 		//sprintf(buf, "\e[%d;1H!\e[%d;%dH!", y+1, y+1, VT100_WIDTH);
-		sprintf(buf, "\e[%d;1H", y+1);
+		sprintf_P(buf, PSTR("\e[%d;1H"), y+1);
 		vt100_puts(buf);
 		for(int c = 0; c < VT100_WIDTH; c++){
 			vt100_putc('!');
@@ -235,22 +270,22 @@ void test_scroll(){
 	}
 
 	// scroll the scroll region
-	vt100_puts("\e[99;1H\eD\eD");
-	vt100_puts("\e[1;1H\eM\eM");
-	vt100_puts("\e[99;1H\eD");
+	vt100_puts_P(PSTR("\e[99;1H\eD\eD"));
+	vt100_puts_P(PSTR("\e[1;1H\eM\eM"));
+	vt100_puts_P(PSTR("\e[99;1H\eD"));
 
 	// clear out an area in the middle and draw text
 	for(int y = 0; y < 5; y++){
-		sprintf(buf, "\e[%d;6H", y+10);
+		sprintf_P(buf, PSTR("\e[%d;6H"), y+10);
 		vt100_puts(buf);
 	
 		for(int c = 0; c < 30; c++){
 			vt100_putc(' ');
 		}
 	}
-	vt100_puts("\e[11;10HMust be ! filled with 2");
-	vt100_puts("\e[12;10H    empty lines at");
-	vt100_puts("\e[13;10H    top and bottom! ");
+	vt100_puts_P(PSTR("\e[11;10HMust be ! filled with 2"));
+	vt100_puts_P(PSTR("\e[12;10H    empty lines at"));
+	vt100_puts_P(PSTR("\e[13;10H    top and bottom! "));
 	
 }
 
@@ -296,13 +331,13 @@ Computer editing
 */
 
 void test_edit(){
-	char buf[32];
+	char buf[24];
 
 	// clear screen
-	vt100_puts("\e[c\e[2J\e[m\e[r\e[?6l\e[1;1H");
+	vt100_puts_P(PSTR("\e[c\e[2J\e[m\e[r\e[?6l\e[1;1H"));
 
 	// enable auto wrap mode
-	vt100_puts("\e[?7h");
+	vt100_puts_P(PSTR("\e[?7h"));
 	
 	// fill entire screen with 'x'
 	int size = (VT100_WIDTH * VT100_HEIGHT); 
@@ -311,44 +346,44 @@ void test_edit(){
 	}
 
 	// clear bottom and top halves (will remove all 'x' s)
-	vt100_puts("\e[20;1H"); 
-	vt100_puts("\e[J");
+	vt100_puts_P(PSTR("\e[20;1H")); 
+	vt100_puts_P(PSTR("\e[J"));
 	_delay_ms(1000);
-	vt100_puts("\e[1J");
-	vt100_puts("\e[?7l");
+	vt100_puts_P(PSTR("\e[1J"));
+	vt100_puts_P(PSTR("\e[?7l"));
 	_delay_ms(1000); 
 	
 	// draw left and right borders using erase function
 	for(int c = 29; c < VT100_HEIGHT; c+=2){
-		sprintf(buf, "\e[%d;1H", c + 1);
+		sprintf_P(buf, PSTR("\e[%d;1H"), c + 1);
 		vt100_puts(buf);
 		// draw two lines of *
 		for(int j = 0; j < VT100_WIDTH; j++){
-			vt100_puts("*\e[B\e[D*\e[A");
+			vt100_puts_P(PSTR("*\e[B\e[D*\e[A"));
 		}
 		// erase end of first line and beginning of second line
 		// goto c;3, erase end, goto c;(w-1), write **
-		sprintf(buf, "\e[%d;3H\e[0K\e[%d;%dH**",
+		sprintf_P(buf, PSTR("\e[%d;3H\e[0K\e[%d;%dH**"),
 			c + 1, c + 1, VT100_WIDTH - 1);
 		vt100_puts(buf);
 		// goto (c+1);(width-2), erase beginning of line, goto (c+2);1, write **
-		sprintf(buf, "\e[%d;%dH\e[1K\e[%d;1H**",
+		sprintf_P(buf, PSTR("\e[%d;%dH\e[1K\e[%d;1H**"),
 			c + 2, VT100_WIDTH - 2, c + 2);
 		vt100_puts(buf); 
 	}
 	
 	// fill border at the bottom
 	for(int c = 2; c < VT100_WIDTH - 2; c++){
-		sprintf(buf, "\e[30;%dH*\e[B\e[D*\e[A", c + 1); 
+		sprintf_P(buf, PSTR("\e[30;%dH*\e[B\e[D*\e[A"), c + 1); 
 		vt100_puts(buf);
 	}
 	// fill border at the bottom
 	for(int c = 2; c < VT100_WIDTH - 2; c++){
-		sprintf(buf, "\e[39;%dH*\e[B\e[D*\e[A", c + 1); 
+		sprintf_P(buf, PSTR("\e[39;%dH*\e[B\e[D*\e[A"), c + 1); 
 		vt100_puts(buf);
 	}
 	// draw text
-	vt100_puts("\e[35;4HYou should see border and NO x:s"); 
+	vt100_puts_P(PSTR("\e[35;4HYou should see border and NO x:s")); 
 }
 /**
 	Tests terminal colors
@@ -390,49 +425,49 @@ void test_edit(){
 */
 
 void test_colors(){
-	char buf[32];
+	char buf[24];
 	
 	// reset terminal and clear screen. Cursor at 1;1.
 	// reset all modes
-	vt100_puts("\e[c\e[2J\e[m\e[r\e[?6l\e[1;1H");
+	vt100_puts_P(PSTR("\e[c\e[2J\e[m\e[r\e[?6l\e[1;1H"));
 
 	// set top margin 3 lines, bottom margin 5 lines
-	vt100_puts("\e[4;36r");
+	vt100_puts_P(PSTR("\e[4;35r"));
 
 	// set bg color to red and text to white
-	vt100_puts("\e[41;37m");
+	vt100_puts_P(PSTR("\e[41;37m"));
 	
 	// draw top and bottom windows
-	vt100_puts("\e[1;1H#\e[2;1H#\e[3;1H#\e[1;40H#\e[2;40H#\e[3;40H#");
-	vt100_puts("\e[1;1H"); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#'); 
-	vt100_puts("\e[3;1H"); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#');
+	vt100_puts_P(PSTR("\e[1;1H#\e[2;1H#\e[3;1H#\e[1;40H#\e[2;40H#\e[3;40H#"));
+	vt100_puts_P(PSTR("\e[1;1H")); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#'); 
+	vt100_puts_P(PSTR("\e[3;1H")); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#');
 
 	// background blue
-	vt100_puts("\e[44;37m");
+	vt100_puts_P(PSTR("\e[44;37m"));
 	
-	vt100_puts("\e[36;1H#\e[37;1H#\e[38;1H#\e[39;1H#\e[40;1H#");
-	vt100_puts("\e[36;40H#\e[37;40H#\e[38;40H#\e[39;40H#\e[40;40H#");
-	vt100_puts("\e[36;1H"); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#'); 
-	vt100_puts("\e[40;1H"); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#');
+	vt100_puts_P(PSTR("\e[36;1H#\e[37;1H#\e[38;1H#\e[39;1H#\e[40;1H#"));
+	vt100_puts_P(PSTR("\e[36;40H#\e[37;40H#\e[38;40H#\e[39;40H#\e[40;40H#"));
+	vt100_puts_P(PSTR("\e[36;1H")); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#'); 
+	vt100_puts_P(PSTR("\e[40;1H")); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('#');
 
 	// foreground white
-	vt100_puts("\e[37;40m");
+	vt100_puts_P(PSTR("\e[37;40m"));
 	
 	// print some text that should not move
-	vt100_puts("\e[2;4HThis is top text (should not move)"); 
-	vt100_puts("\e[38;3HThis is bottom text (should not move)");
+	vt100_puts_P(PSTR("\e[2;4HThis is top text (should not move)")); 
+	vt100_puts_P(PSTR("\e[38;3HThis is bottom text (should not move)"));
 
 	// green background, black text
-	vt100_puts("\e[42;30m");
+	vt100_puts_P(PSTR("\e[42;30m"));
 	
 	// set origin mode and print border around the scroll region
-	vt100_puts("\e[?6h");
-	vt100_puts("\e[1;1H"); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('!');
+	vt100_puts_P(PSTR("\e[?6h"));
+	vt100_puts_P(PSTR("\e[1;1H")); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('!');
 	// origin mode should snap 99 to last line in scroll region
-	vt100_puts("\e[99;1H"); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('!');
+	vt100_puts_P(PSTR("\e[99;1H")); for(int x = 0; x < VT100_WIDTH; x++) vt100_putc('!');
 	for(int y = 0; y < VT100_HEIGHT; y++){
 		//sprintf(buf, "\e[%d;1H!\e[%d;%dH!", y+1, y+1, VT100_WIDTH);
-		sprintf(buf, "\e[%d;1H", y+1);
+		sprintf_P(buf, PSTR("\e[%d;1H"), y+1);
 		vt100_puts(buf);
 		for(int c = 0; c < VT100_WIDTH; c++){
 			vt100_putc('!');
@@ -440,30 +475,30 @@ void test_colors(){
 	}
 
 	// scroll the scroll region
-	vt100_puts("\e[99;1H\eD\eD");
-	vt100_puts("\e[1;1H\eM\eM");
-	vt100_puts("\e[99;1H\eD");
+	vt100_puts_P(PSTR("\e[99;1H\eD\eD"));
+	vt100_puts_P(PSTR("\e[1;1H\eM\eM"));
+	vt100_puts_P(PSTR("\e[99;1H\eD"));
 
 	// black background, yellow text
-	vt100_puts("\e[33;40m");
+	vt100_puts_P(PSTR("\e[33;40m"));
 	
 	// clear out an area in the middle and draw text
 	for(int y = 0; y < 5; y++){
-		sprintf(buf, "\e[%d;6H", y+10);
+		sprintf_P(buf, PSTR("\e[%d;6H"), y+10);
 		vt100_puts(buf);
 	
 		for(int c = 0; c < 30; c++){
 			vt100_putc(' ');
 		}
 	}
-	vt100_puts("\e[11;10HMust be ! filled with 2");
-	vt100_puts("\e[12;10H    empty lines at");
-	vt100_puts("\e[13;10H    top and bottom! ");
+	vt100_puts_P(PSTR("\e[11;10HMust be ! filled with 2"));
+	vt100_puts_P(PSTR("\e[12;10H    empty lines at"));
+	vt100_puts_P(PSTR("\e[13;10H    top and bottom! "));
 
 }
 
 int main(int argc, char **argv){
-	uart_init(UART_BAUD_SELECT(38400, F_CPU));
+	uart_init(UART_BAUD_SELECT(UART_BAUD, F_CPU));
 	
 	ili9340_init();
 	ili9340_setRotation(0);
@@ -473,15 +508,13 @@ int main(int argc, char **argv){
 	}; 
 	vt100_init(respond);
 
-	// just clear the screen initially
-	for(int c = 0; c < 320; c++){
-		ili9340_drawFastHLine(0, c, 320, 0x0000);
-	}
-
 	sei();
 	
-	// reset terminal and disable auto wrap
-	vt100_puts("\ec\e[?7l");
+	// reset terminal and disable auto wrap. The reset erases the screen
+	// lazily: the rows are cleared a step at a time by the flushes in the
+	// main loop, so input that arrives meanwhile is not lost
+	const char *reset = PSTR("\ec\e[?7l");
+	for(uint8_t c; (c = pgm_read_byte(reset++));) vt100_write(&c, 1);
 /*
 	while(1){
 		test_colors();
@@ -553,21 +586,57 @@ int main(int argc, char **argv){
 		}
 		_delay_ms(2000);
 	}*/
+	// bytes are collected from the uart buffer and handed to the terminal in
+	// chunks so that plain text is parsed a whole run at a time. Drawing is
+	// deferred: whenever the uart queue is empty one changed row is drawn,
+	// and every frame as much of the screen as the uart buffer allows is
+	// brought up to date so that a continuous stream still shows up. Bytes the
+	// terminal does not take yet (they have to wait for a row to be drawn)
+	// stay at the start of buf and are passed again after a step
+	TCCR1A = 0;
+	TCCR1B = _BV(CS12) | _BV(CS10); // timer1 counts at F_CPU/1024
+	uint16_t frame = TCNT1;
+	uint8_t buf[32], len = 0;
 	while(1){
-		unsigned int data = uart_getc();
-		if(data == UART_NO_DATA) continue;
-		if(data == 0xb4){ // ´ key on my kb
-			test_colors();
-			_delay_ms(5000); 
-			test_cursor();
-			_delay_ms(5000);
-			test_edit();
-			_delay_ms(5000);
-			test_scroll();
-			_delay_ms(5000);
+		while(len < sizeof(buf)){
+			unsigned int data = uart_getc();
+			if(data == UART_NO_DATA) break;
+			if(data == 0xb4){ // ´ key on my kb
+				for(uint8_t n; len; len -= n){
+					n = vt100_write(buf, len);
+					memmove(buf, buf + n, len - n);
+					vt100_flush(1);
+				}
+				test_colors();
+				_delay_ms(5000);
+				test_cursor();
+				_delay_ms(5000);
+				test_edit();
+				_delay_ms(5000);
+				test_scroll();
+				_delay_ms(5000);
+				char report[24];
+				sprintf_P(report, PSTR("stack: %u bytes free\r\n"), _stack_unused());
+				uart_puts(report);
+			}
+			buf[len++] = data;
+		}
+		if(len){
+			uint8_t n = vt100_write(buf, len);
+			memmove(buf, buf + n, len -= n);
 		}
-		vt100_putc(data);
 		//uart_putc(data);
+		if(len){
+			vt100_flush(1);
+		} else if((uint16_t)(TCNT1 - frame) >= FRAME_TICKS){
+			// a step takes up to 2ms, stop before the uart buffer gets full. With
+			// a backlog above BACKLOG_LIMIT the terminal only updates its model
+			// and scrolls without drawing (jump scroll) until the input slows
+			while(vt100_flush(1) && uart_waiting() < BACKLOG_LIMIT);
+			frame = TCNT1;
+		} else if(!uart_waiting()){
+			vt100_flush(1);
+		}
 	}
 	
 	return 0; 
@@ -44,272 +44,49 @@
 #define RST_PIN PB1
 #define DC_PIN PB0
 
+// With ILI9340_SPI_PIPELINE the SPI data register is used as a one byte
+// transmit queue: _spi_write waits for the previous byte to finish before it
+// loads the next one and returns while that byte is still shifting out. The
+// work done between writes (glyph bit tests, loop counters, and after the
+// last byte of a glyph the vt100 parser itself) then overlaps with the 16
+// cycles of the transfer instead of following it. The cost is that CS and DC
+// may only change once the queue has drained, so the macros below do that.
+// (An SPI interrupt per byte does not pay off: at F_CPU/2 the ISR entry and
+// exit alone take longer than shifting out the byte.)
+#ifndef ILI9340_SPI_PIPELINE
+#define ILI9340_SPI_PIPELINE 1
+#endif
+
+#if ILI9340_SPI_PIPELINE
+#define SPI_DRAIN while(!(SPSR & _BV(SPIF)))
+#else
+#define SPI_DRAIN
+#endif
+
 #define _SB(port, pin) {port |= _BV(pin);}
 #define _RB(port, pin) {port &= ~_BV(pin);}
-#define CS_HI _SB(ILI_PORT, CS_PIN)
-#define CS_LO _RB(ILI_PORT, CS_PIN)
+#define CS_HI {SPI_DRAIN; _SB(ILI_PORT, CS_PIN)}
+#define CS_LO {SPI_DRAIN; _RB(ILI_PORT, CS_PIN)}
 #define RST_HI _SB(ILI_PORT, RST_PIN)
 #define RST_LO _RB(ILI_PORT, RST_PIN)
-#define DC_HI _SB(ILI_PORT, DC_PIN)
-#define DC_LO _RB(ILI_PORT, DC_PIN)
-
-static const unsigned char font[] PROGMEM = {
-0x00, 0x00, 0x00, 0x00, 0x00,
-0x3E, 0x5B, 0x4F, 0x5B, 0x3E,
-0x3E, 0x6B, 0x4F, 0x6B, 0x3E,
-0x1C, 0x3E, 0x7C, 0x3E, 0x1C,
-0x18, 0x3C, 0x7E, 0x3C, 0x18,
-0x1C, 0x57, 0x7D, 0x57, 0x1C,
-0x1C, 0x5E, 0x7F, 0x5E, 0x1C,
-0x00, 0x18, 0x3C, 0x18, 0x00,
-0xFF, 0xE7, 0xC3, 0xE7, 0xFF,
-0x00, 0x18, 0x24, 0x18, 0x00,
-0xFF, 0xE7, 0xDB, 0xE7, 0xFF,
-0x30, 0x48, 0x3A, 0x06, 0x0E,
-0x26, 0x29, 0x79, 0x29, 0x26,
-0x40, 0x7F, 0x05, 0x05, 0x07,
-0x40, 0x7F, 0x05, 0x25, 0x3F,
-0x5A, 0x3C, 0xE7, 0x3C, 0x5A,
-0x7F, 0x3E, 0x1C, 0x1C, 0x08,
-0x08, 0x1C, 0x1C, 0x3E, 0x7F,
-0x14, 0x22, 0x7F, 0x22, 0x14,
-0x5F, 0x5F, 0x00, 0x5F, 0x5F,
-0x06, 0x09, 0x7F, 0x01, 0x7F,
-0x00, 0x66, 0x89, 0x95, 0x6A,
-0x60, 0x60, 0x60, 0x60, 0x60,
-0x94, 0xA2, 0xFF, 0xA2, 0x94,
-0x08, 0x04, 0x7E, 0x04, 0x08,
-0x10, 0x20, 0x7E, 0x20, 0x10,
-0x08, 0x08, 0x2A, 0x1C, 0x08,
-0x08, 0x1C, 0x2A, 0x08, 0x08,
-0x1E, 0x10, 0x10, 0x10, 0x10,
-0x0C, 0x1E, 0x0C, 0x1E, 0x0C,
-0x30, 0x38, 0x3E, 0x38, 0x30,
-0x06, 0x0E, 0x3E, 0x0E, 0x06,
-0x00, 0x00, 0x00, 0x00, 0x00,
-0x00, 0x00, 0x5F, 0x00, 0x00,
-0x00, 0x07, 0x00, 0x07, 0x00,
-0x14, 0x7F, 0x14, 0x7F, 0x14,
-0x24, 0x2A, 0x7F, 0x2A, 0x12,
-0x23, 0x13, 0x08, 0x64, 0x62,
-0x36, 0x49, 0x56, 0x20, 0x50,
-0x00, 0x08, 0x07, 0x03, 0x00,
-0x00, 0x1C, 0x22, 0x41, 0x00,
-0x00, 0x41, 0x22, 0x1C, 0x00,
-0x2A, 0x1C, 0x7F, 0x1C, 0x2A,
-0x08, 0x08, 0x3E, 0x08, 0x08,
-0x00, 0x80, 0x70, 0x30, 0x00,
-0x08, 0x08, 0x08, 0x08, 0x08,
-0x00, 0x00, 0x60, 0x60, 0x00,
-0x20, 0x10, 0x08, 0x04, 0x02,
-0x3E, 0x51, 0x49, 0x45, 0x3E,
-0x00, 0x42, 0x7F, 0x40, 0x00,
-0x72, 0x49, 0x49, 0x49, 0x46,
-0x21, 0x41, 0x49, 0x4D, 0x33,
-0x18, 0x14, 0x12, 0x7F, 0x10,
-0x27, 0x45, 0x45, 0x45, 0x39,
-0x3C, 0x4A, 0x49, 0x49, 0x31,
-0x41, 0x21, 0x11, 0x09, 0x07,
-0x36, 0x49, 0x49, 0x49, 0x36,
-0x46, 0x49, 0x49, 0x29, 0x1E,
-0x00, 0x00, 0x14, 0x00, 0x00,
-0x00, 0x40, 0x34, 0x00, 0x00,
-0x00, 0x08, 0x14, 0x22, 0x41,
-0x14, 0x14, 0x14, 0x14, 0x14,
-0x00, 0x41, 0x22, 0x14, 0x08,
-0x02, 0x01, 0x59, 0x09, 0x06,
-0x3E, 0x41, 0x5D, 0x59, 0x4E,
-0x7C, 0x12, 0x11, 0x12, 0x7C,
-0x7F, 0x49, 0x49, 0x49, 0x36,
-0x3E, 0x41, 0x41, 0x41, 0x22,
-0x7F, 0x41, 0x41, 0x41, 0x3E,
-0x7F, 0x49, 0x49, 0x49, 0x41,
-0x7F, 0x09, 0x09, 0x09, 0x01,
-0x3E, 0x41, 0x41, 0x51, 0x73,
-0x7F, 0x08, 0x08, 0x08, 0x7F,
-0x00, 0x41, 0x7F, 0x41, 0x00,
-0x20, 0x40, 0x41, 0x3F, 0x01,
-0x7F, 0x08, 0x14, 0x22, 0x41,
-0x7F, 0x40, 0x40, 0x40, 0x40,
-0x7F, 0x02, 0x1C, 0x02, 0x7F,
-0x7F, 0x04, 0x08, 0x10, 0x7F,
-0x3E, 0x41, 0x41, 0x41, 0x3E,
-0x7F, 0x09, 0x09, 0x09, 0x06,
-0x3E, 0x41, 0x51, 0x21, 0x5E,
-0x7F, 0x09, 0x19, 0x29, 0x46,
-0x26, 0x49, 0x49, 0x49, 0x32,
-0x03, 0x01, 0x7F, 0x01, 0x03,
-0x3F, 0x40, 0x40, 0x40, 0x3F,
-0x1F, 0x20, 0x40, 0x20, 0x1F,
-0x3F, 0x40, 0x38, 0x40, 0x3F,
-0x63, 0x14, 0x08, 0x14, 0x63,
-0x03, 0x04, 0x78, 0x04, 0x03,
-0x61, 0x59, 0x49, 0x4D, 0x43,
-0x00, 0x7F, 0x41, 0x41, 0x41,
-0x02, 0x04, 0x08, 0x10, 0x20,
-0x00, 0x41, 0x41, 0x41, 0x7F,
-0x04, 0x02, 0x01, 0x02, 0x04,
-0x40, 0x40, 0x40, 0x40, 0x40,
-0x00, 0x03, 0x07, 0x08, 0x00,
-0x20, 0x54, 0x54, 0x78, 0x40,
-0x7F, 0x28, 0x44, 0x44, 0x38,
-0x38, 0x44, 0x44, 0x44, 0x28,
-0x38, 0x44, 0x44, 0x28, 0x7F,
-0x38, 0x54, 0x54, 0x54, 0x18,
-0x00, 0x08, 0x7E, 0x09, 0x02,
-0x18, 0xA4, 0xA4, 0x9C, 0x78,
-0x7F, 0x08, 0x04, 0x04, 0x78,
-0x00, 0x44, 0x7D, 0x40, 0x00,
-0x20, 0x40, 0x40, 0x3D, 0x00,
-0x7F, 0x10, 0x28, 0x44, 0x00,
-0x00, 0x41, 0x7F, 0x40, 0x00,
-0x7C, 0x04, 0x78, 0x04, 0x78,
-0x7C, 0x08, 0x04, 0x04, 0x78,
-0x38, 0x44, 0x44, 0x44, 0x38,
-0xFC, 0x18, 0x24, 0x24, 0x18,
-0x18, 0x24, 0x24, 0x18, 0xFC,
-0x7C, 0x08, 0x04, 0x04, 0x08,
-0x48, 0x54, 0x54, 0x54, 0x24,
-0x04, 0x04, 0x3F, 0x44, 0x24,
-0x3C, 0x40, 0x40, 0x20, 0x7C,
-0x1C, 0x20, 0x40, 0x20, 0x1C,
-0x3C, 0x40, 0x30, 0x40, 0x3C,
-0x44, 0x28, 0x10, 0x28, 0x44,
-0x4C, 0x90, 0x90, 0x90, 0x7C,
-0x44, 0x64, 0x54, 0x4C, 0x44,
-0x00, 0x08, 0x36, 0x41, 0x00,
-0x00, 0x00, 0x77, 0x00, 0x00,
-0x00, 0x41, 0x36, 0x08, 0x00,
-0x02, 0x01, 0x02, 0x04, 0x02,
-0x3C, 0x26, 0x23, 0x26, 0x3C,
-0x1E, 0xA1, 0xA1, 0x61, 0x12,
-0x3A, 0x40, 0x40, 0x20, 0x7A,
-0x38, 0x54, 0x54, 0x55, 0x59,
-0x21, 0x55, 0x55, 0x79, 0x41,
-0x22, 0x54, 0x54, 0x78, 0x42, // a-umlaut
-0x21, 0x55, 0x54, 0x78, 0x40,
-0x20, 0x54, 0x55, 0x79, 0x40,
-0x0C, 0x1E, 0x52, 0x72, 0x12,
-0x39, 0x55, 0x55, 0x55, 0x59,
-0x39, 0x54, 0x54, 0x54, 0x59,
-0x39, 0x55, 0x54, 0x54, 0x58,
-0x00, 0x00, 0x45, 0x7C, 0x41,
-0x00, 0x02, 0x45, 0x7D, 0x42,
-0x00, 0x01, 0x45, 0x7C, 0x40,
-0x7D, 0x12, 0x11, 0x12, 0x7D, // A-umlaut
-0xF0, 0x28, 0x25, 0x28, 0xF0,
-0x7C, 0x54, 0x55, 0x45, 0x00,
-0x20, 0x54, 0x54, 0x7C, 0x54,
-0x7C, 0x0A, 0x09, 0x7F, 0x49,
-0x32, 0x49, 0x49, 0x49, 0x32,
-0x3A, 0x44, 0x44, 0x44, 0x3A, // o-umlaut
-0x32, 0x4A, 0x48, 0x48, 0x30,
-0x3A, 0x41, 0x41, 0x21, 0x7A,
-0x3A, 0x42, 0x40, 0x20, 0x78,
-0x00, 0x9D, 0xA0, 0xA0, 0x7D,
-0x3D, 0x42, 0x42, 0x42, 0x3D, // O-umlaut
-0x3D, 0x40, 0x40, 0x40, 0x3D,
-0x3C, 0x24, 0xFF, 0x24, 0x24,
-0x48, 0x7E, 0x49, 0x43, 0x66,
-0x2B, 0x2F, 0xFC, 0x2F, 0x2B,
-0xFF, 0x09, 0x29, 0xF6, 0x20,
-0xC0, 0x88, 0x7E, 0x09, 0x03,
-0x20, 0x54, 0x54, 0x79, 0x41,
-0x00, 0x00, 0x44, 0x7D, 0x41,
-0x30, 0x48, 0x48, 0x4A, 0x32,
-0x38, 0x40, 0x40, 0x22, 0x7A,
-0x00, 0x7A, 0x0A, 0x0A, 0x72,
-0x7D, 0x0D, 0x19, 0x31, 0x7D,
-0x26, 0x29, 0x29, 0x2F, 0x28,
-0x26, 0x29, 0x29, 0x29, 0x26,
-0x30, 0x48, 0x4D, 0x40, 0x20,
-0x38, 0x08, 0x08, 0x08, 0x08,
-0x08, 0x08, 0x08, 0x08, 0x38,
-0x2F, 0x10, 0xC8, 0xAC, 0xBA,
-0x2F, 0x10, 0x28, 0x34, 0xFA,
-0x00, 0x00, 0x7B, 0x00, 0x00,
-0x08, 0x14, 0x2A, 0x14, 0x22,
-0x22, 0x14, 0x2A, 0x14, 0x08,
-0xAA, 0x00, 0x55, 0x00, 0xAA,
-0xAA, 0x55, 0xAA, 0x55, 0xAA,
-0x00, 0x00, 0x00, 0xFF, 0x00,
-0x10, 0x10, 0x10, 0xFF, 0x00,
-0x14, 0x14, 0x14, 0xFF, 0x00,
-0x10, 0x10, 0xFF, 0x00, 0xFF,
-0x10, 0x10, 0xF0, 0x10, 0xF0,
-0x14, 0x14, 0x14, 0xFC, 0x00,
-0x14, 0x14, 0xF7, 0x00, 0xFF,
-0x00, 0x00, 0xFF, 0x00, 0xFF,
-0x14, 0x14, 0xF4, 0x04, 0xFC,
-0x14, 0x14, 0x17, 0x10, 0x1F,
-0x10, 0x10, 0x1F, 0x10, 0x1F,
-0x14, 0x14, 0x14, 0x1F, 0x00,
-0x10, 0x10, 0x10, 0xF0, 0x00,
-0x00, 0x00, 0x00, 0x1F, 0x10,
-0x10, 0x10, 0x10, 0x1F, 0x10,
-0x10, 0x10, 0x10, 0xF0, 0x10,
-0x00, 0x00, 0x00, 0xFF, 0x10,
-0x10, 0x10, 0x10, 0x10, 0x10,
-0x10, 0x10, 0x10, 0xFF, 0x10,
-0x00, 0x00, 0x00, 0xFF, 0x14,
-0x00, 0x00, 0xFF, 0x00, 0xFF,
-0x00, 0x00, 0x1F, 0x10, 0x17,
-0x00, 0x00, 0xFC, 0x04, 0xF4,
-0x14, 0x14, 0x17, 0x10, 0x17,
-0x14, 0x14, 0xF4, 0x04, 0xF4,
-0x00, 0x00, 0xFF, 0x00, 0xF7,
-0x14, 0x14, 0x14, 0x14, 0x14,
-0x14, 0x14, 0xF7, 0x00, 0xF7,
-0x14, 0x14, 0x14, 0x17, 0x14,
-0x10, 0x10, 0x1F, 0x10, 0x1F,
-0x14, 0x14, 0x14, 0xF4, 0x14,
-0x10, 0x10, 0xF0, 0x10, 0xF0,
-0x00, 0x00, 0x1F, 0x10, 0x1F,
-0x00, 0x00, 0x00, 0x1F, 0x14,
-0x00, 0x00, 0x00, 0xFC, 0x14,
-0x00, 0x00, 0xF0, 0x10, 0xF0,
-0x10, 0x10, 0xFF, 0x10, 0xFF,
-0x14, 0x14, 0x14, 0xFF, 0x14,
-0x10, 0x10, 0x10, 0x1F, 0x00,
-0x00, 0x00, 0x00, 0xF0, 0x10,
-0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
-0xF0, 0xF0, 0xF0, 0xF0, 0xF0,
-0xFF, 0xFF, 0xFF, 0x00, 0x00,
-0x00, 0x00, 0x00, 0xFF, 0xFF,
-0x0F, 0x0F, 0x0F, 0x0F, 0x0F,
-0x38, 0x44, 0x44, 0x38, 0x44,
-0xFC, 0x4A, 0x4A, 0x4A, 0x34, // sharp-s or beta
-0x7E, 0x02, 0x02, 0x06, 0x06,
-0x02, 0x7E, 0x02, 0x7E, 0x02,
-0x63, 0x55, 0x49, 0x41, 0x63,
-0x38, 0x44, 0x44, 0x3C, 0x04,
-0x40, 0x7E, 0x20, 0x1E, 0x20,
-0x06, 0x02, 0x7E, 0x02, 0x02,
-0x99, 0xA5, 0xE7, 0xA5, 0x99,
-0x1C, 0x2A, 0x49, 0x2A, 0x1C,
-0x4C, 0x72, 0x01, 0x72, 0x4C,
-0x30, 0x4A, 0x4D, 0x4D, 0x30,
-0x30, 0x48, 0x78, 0x48, 0x30,
-0xBC, 0x62, 0x5A, 0x46, 0x3D,
-0x3E, 0x49, 0x49, 0x49, 0x00,
-0x7E, 0x01, 0x01, 0x01, 0x7E,
-0x2A, 0x2A, 0x2A, 0x2A, 0x2A,
-0x44, 0x44, 0x5F, 0x44, 0x44,
-0x40, 0x51, 0x4A, 0x44, 0x40,
-0x40, 0x44, 0x4A, 0x51, 0x40,
-0x00, 0x00, 0xFF, 0x01, 0x03,
-0xE0, 0x80, 0xFF, 0x00, 0x00,
-0x08, 0x08, 0x6B, 0x6B, 0x08,
-0x36, 0x12, 0x36, 0x24, 0x36,
-0x06, 0x0F, 0x09, 0x0F, 0x06,
-0x00, 0x00, 0x18, 0x18, 0x00,
-0x00, 0x00, 0x10, 0x10, 0x00,
-0x30, 0x40, 0xFF, 0x01, 0x01,
-0x00, 0x1F, 0x01, 0x01, 0x1E,
-0x00, 0x19, 0x1D, 0x17, 0x12,
-0x00, 0x3C, 0x3C, 0x3C, 0x3C,
-0x00, 0x00, 0x00, 0x00, 0x00
-};
+#define DC_HI {SPI_DRAIN; _SB(ILI_PORT, DC_PIN)}
+#define DC_LO {SPI_DRAIN; _RB(ILI_PORT, DC_PIN)}
+
+// Glyphs are drawn from font_rows.h, which tools/fontconv.c generates from
+// the column-major font5x7.h at build time: one byte per glyph scanline, so
+// the glyph loops below read a scanline once and shift out its 6 pixels instead
+// of reading all 5 columns and masking out one bit of each. Build with
+// -DILI9340_FONT_ROWS=0 to draw from font5x7.h directly (for comparison, and
+// for builds that can't run the converter).
+#ifndef ILI9340_FONT_ROWS
+#define ILI9340_FONT_ROWS 1
+#endif
+
+#if ILI9340_FONT_ROWS
+#include "font_rows.h"
+#else
+#include "font5x7.h"
+#endif
 
 //static uint16_t _width = ILI9340_TFTWIDTH, _height  = ILI9340_TFTHEIGHT;
 
@@ -319,8 +96,23 @@ static struct ili9340 {
 	int8_t char_width, char_height;
 	uint16_t back_color, front_color;
 	uint16_t scroll_start; 
+	// fixed areas above and below the scroll area, and whether the rows run
+	// against the panel's own (rotation 2), which turns them around for the
+	// scroll registers
+	uint16_t scroll_top, scroll_bottom;
+	uint8_t scroll_flip;
+	// column and page range last sent to the controller, so that a window
+	// on the same row only needs CASET and one in the same columns only
+	// PASET. Cleared whenever the controller may no longer hold them
+	int16_t win_x0, win_x1, win_y0, win_y1;
+	uint8_t win_valid;
+	// page at which the last ili9340_fillLines stopped inside the current
+	// window, ILI9340_NO_FILL once anything else was written to RAM
+	uint16_t fill_next;
 } term;
 
+#define ILI9340_NO_FILL 0xffff
+
 
 void _spi_init(void) {
     SPI_DDR &= ~((1<<SPI_MISO)); //input
@@ -338,46 +130,172 @@ void _spi_init(void) {
             (0<<CPHA));             // Clock Phase (0:leading / 1:trailing edge sampling)
 
     SPSR = (1<<SPI2X); // Double SPI Speed Bit
+
+#if ILI9340_SPI_PIPELINE
+		// start one transfer (a NOP, the panel is still held in reset) so that
+		// SPIF is already set when the first real byte is queued
+		SPDR = ILI9340_NOP;
+#endif
 }
 
 void _spi_write(uint8_t c) {
+#if ILI9340_SPI_PIPELINE
+	SPI_DRAIN;
+	SPDR = c;
+#else
 	SPDR = c;
 	while(!(SPSR & _BV(SPIF)));
+#endif
+}
+
+// Pixel streams of the drawing paths: count pixels of one color for the
+// fills, and one scanline of n glyphs for the text
+static void _spi_stream_fill(uint8_t hi, uint8_t lo, uint32_t count){
+	if(hi == lo){
+		// black and white (the erases): one byte value for the whole run
+		for(count <<= 1; count >= 8; count -= 8){
+			_spi_write(hi); _spi_write(hi); _spi_write(hi); _spi_write(hi);
+			_spi_write(hi); _spi_write(hi); _spi_write(hi); _spi_write(hi);
+		}
+		while(count--) _spi_write(hi);
+		return;
+	}
+	for(; count >= 4; count -= 4){
+		_spi_write(hi); _spi_write(lo); _spi_write(hi); _spi_write(lo);
+		_spi_write(hi); _spi_write(lo); _spi_write(hi); _spi_write(lo);
+	}
+	while(count--){
+		_spi_write(hi);
+		_spi_write(lo);
+	}
 }
 
+#if ILI9340_FONT_ROWS
+
+// The glyph rows are expanded through a table of the SPI bytes for every 4
+// pixel pattern in the current colors, so a glyph scanline is 12 byte loads
+// and stores with no per pixel test. The table is 128 bytes of ram, which the
+// 2 KB parts can't spare; there the colors are only kept split into their
+// high and low bytes.
+#ifndef ILI9340_EXPAND_LUT
+#if defined(RAMEND) && RAMEND < 0x1000
+#define ILI9340_EXPAND_LUT 0
+#else
+#define ILI9340_EXPAND_LUT 1
+#endif
+#endif
+
+#if ILI9340_EXPAND_LUT
+
+static struct {
+	uint16_t fg, bg;
+	uint8_t valid;
+	// bytes of 4 pixels for each nibble of a glyph row, msb first
+	uint8_t bytes[16][8];
+} _expand;
+
+// rebuilds the table when the colors differ from the ones it was made for
+static void _expand_colors(uint16_t fg, uint16_t bg){
+	if(_expand.valid && _expand.fg == fg && _expand.bg == bg) return;
+	uint8_t color[2][2] = {{bg >> 8, bg}, {fg >> 8, fg}};
+	for(uint8_t n = 0; n < 16; n++){
+		uint8_t *p = _expand.bytes[n];
+		for(uint8_t b = 4; b--;){
+			const uint8_t *pix = color[(n >> b) & 1];
+			*p++ = pix[0];
+			*p++ = pix[1];
+		}
+	}
+	_expand.fg = fg;
+	_expand.bg = bg;
+	_expand.valid = 1;
+}
+
+static void _spi_stream_glyphs(const uint8_t *chars, uint8_t n, uint8_t row,
+	uint16_t fg, uint16_t bg){
+	const unsigned char *rows = font_rows[row];
+	_expand_colors(fg, bg);
+	for(uint8_t c = 0; c < n; c++){
+		uint8_t bits = pgm_read_byte(rows + chars[c]);
+		// columns 0-3 from the high nibble, column 4 and the separator from
+		// the top half of the low nibble
+		const uint8_t *hi = _expand.bytes[bits >> 4];
+		const uint8_t *lo = _expand.bytes[bits & 0x0f];
+		_spi_write(hi[0]); _spi_write(hi[1]);
+		_spi_write(hi[2]); _spi_write(hi[3]);
+		_spi_write(hi[4]); _spi_write(hi[5]);
+		_spi_write(hi[6]); _spi_write(hi[7]);
+		_spi_write(lo[0]); _spi_write(lo[1]);
+		_spi_write(lo[2]); _spi_write(lo[3]);
+	}
+}
+
+#else
+
+static void _spi_stream_glyphs(const uint8_t *chars, uint8_t n, uint8_t row,
+	uint16_t fg, uint16_t bg){
+	const unsigned char *rows = font_rows[row];
+	uint8_t color[2][2] = {{bg >> 8, bg}, {fg >> 8, fg}};
+	for(uint8_t c = 0; c < n; c++){
+		uint8_t bits = pgm_read_byte(rows + chars[c]);
+		for(uint8_t j = 0; j < 6; j++){
+			const uint8_t *pix = color[bits >> 7];
+			bits <<= 1;
+			_spi_write(pix[0]);
+			_spi_write(pix[1]);
+		}
+	}
+}
+
+#endif
+
+#else
+
+static void _spi_stream_glyphs(const uint8_t *chars, uint8_t n, uint8_t row,
+	uint16_t fg, uint16_t bg){
+	uint8_t mask = _BV(row);
+	for(uint8_t c = 0; c < n; c++){
+		const unsigned char *glyph = &font5x7[chars[c] * FONT5X7_WIDTH];
+		for(uint8_t j = 0; j < FONT5X7_WIDTH; j++){
+			uint16_t pix = (pgm_read_byte(glyph + j) & mask)?fg:bg;
+			_spi_write(pix >> 8);
+			_spi_write(pix);
+		}
+		_spi_write(bg >> 8);
+		_spi_write(bg);
+	}
+}
+
+#endif
+
+
+// Commands are sent in transactions: CS stays asserted from _wr_begin to
+// _wr_end and _wr_command only drops DC for the command byte itself, so the
+// parameters and pixel data that follow cost no port writes at all. DC is
+// kept high outside of command bytes.
+static void _wr_begin(void){
+	CS_LO;
+}
+
+static void _wr_end(void){
+	CS_HI;
+}
 
 void _wr_command(uint8_t c) {
 	DC_LO;
-	CS_LO; 
-  //CLEAR_BIT(dcport, dcpinmask);
-  //digitalWrite(_dc, LOW);
-  //CLEAR_BIT(clkport, clkpinmask);
-  //digitalWrite(_sclk, LOW);
-  //CLEAR_BIT(csport, cspinmask);
-  //digitalWrite(_cs, LOW);
-
-  _spi_write(c);
-
-	CS_HI; 
-  //SET_BIT(csport, cspinmask);
-  //digitalWrite(_cs, HIGH);
+	_spi_write(c);
+	DC_HI;
 }
 
-
 void _wr_data(uint8_t c) {
-	DC_HI; 
-  CS_LO; 
-  _spi_write(c);
-	CS_HI; 
+	_spi_write(c);
 } 
 
 void _wr_data16(uint16_t c){
-	DC_HI; 
-  CS_LO; 
-  _spi_write(c >> 8);
-  _spi_write(c & 0xff); 
-	CS_HI;
+	_spi_write(c >> 8);
+	_spi_write(c & 0xff); 
 }
+
 // Rather than a bazillion _wr_command() and _wr_data() calls, screen
 // initialization commands and arguments are organized in these tables
 // stored in PROGMEM.  The table may look bulky, but that's mostly the
@@ -385,6 +303,54 @@ void _wr_data16(uint16_t c){
 // than the equivalent code.  Companion function follows.
 #define DELAY 0x80
 
+// number of commands, then per command: the command byte, the number of
+// arguments (with DELAY set when a delay in ms follows the arguments) and
+// the arguments
+static const uint8_t _init_cmds[] PROGMEM = {
+	21,
+	0xEF, 3, 0x03, 0x80, 0x02,
+	0xCF, 3, 0x00, 0xC1, 0x30,
+	0xED, 4, 0x64, 0x03, 0x12, 0x81,
+	0xE8, 3, 0x85, 0x00, 0x78,
+	0xCB, 5, 0x39, 0x2C, 0x00, 0x34, 0x02,
+	0xF7, 1, 0x20,
+	0xEA, 2, 0x00, 0x00,
+	ILI9340_PWCTR1, 1, 0x23, // Power control, VRH[5:0]
+	ILI9340_PWCTR2, 1, 0x10, // Power control, SAP[2:0];BT[3:0]
+	ILI9340_VMCTR1, 2, 0x3e, 0x28, // VCM control
+	ILI9340_VMCTR2, 1, 0x86, // VCM control2
+	ILI9340_MADCTL, 1, ILI9340_MADCTL_MX | ILI9340_MADCTL_BGR, // Memory Access Control
+	ILI9340_PIXFMT, 1, 0x55,
+	ILI9340_FRMCTR1, 2, 0x00, 0x18,
+	ILI9340_DFUNCTR, 3, 0x08, 0x82, 0x27, // Display Function Control
+	0xF2, 1, 0x00, // 3Gamma Function Disable
+	ILI9340_GAMMASET, 1, 0x01, // Gamma curve selected
+	ILI9340_GMCTRP1, 15, // Set Gamma
+		0x0F, 0x31, 0x2B, 0x0C, 0x0E, 0x08, 0x4E, 0xF1,
+		0x37, 0x07, 0x10, 0x03, 0x0E, 0x09, 0x00,
+	ILI9340_GMCTRN1, 15, // Set Gamma
+		0x00, 0x0E, 0x14, 0x03, 0x11, 0x07, 0x31, 0xC1,
+		0x48, 0x08, 0x0F, 0x0C, 0x31, 0x36, 0x0F,
+	ILI9340_SLPOUT, DELAY, 120, // Exit Sleep
+	ILI9340_DISPON, 0, // Display on
+};
+
+// sends a command table (see above) inside an open transaction
+static void _wr_commands(const uint8_t *addr){
+	uint8_t ncmds = pgm_read_byte(addr++);
+	while(ncmds--){
+		_wr_command(pgm_read_byte(addr++));
+		uint8_t nargs = pgm_read_byte(addr++);
+		uint8_t ms = nargs & DELAY;
+		nargs &= ~DELAY;
+		while(nargs--) _wr_data(pgm_read_byte(addr++));
+		if(ms){
+			// _delay_ms needs a constant argument
+			for(ms = pgm_read_byte(addr++); ms; ms--) _delay_ms(1);
+		}
+	}
+}
+
 void ili9340_init(void) {
 	ILI_DDR |= _BV(RST_PIN);
 	ILI_DDR |= _BV(DC_PIN);
@@ -399,114 +365,14 @@ void ili9340_init(void) {
   RST_LO; 
   _delay_ms(20);
   RST_HI; 
-  _delay_ms(150);
-
-  _wr_command(0xEF);
-  _wr_data(0x03);
-  _wr_data(0x80);
-  _wr_data(0x02);
-
-  _wr_command(0xCF);  
-  _wr_data(0x00); 
-  _wr_data(0XC1); 
-  _wr_data(0X30); 
-
-  _wr_command(0xED);  
-  _wr_data(0x64); 
-  _wr_data(0x03); 
-  _wr_data(0X12); 
-  _wr_data(0X81); 
- 
-  _wr_command(0xE8);  
-  _wr_data(0x85); 
-  _wr_data(0x00); 
-  _wr_data(0x78); 
-
-  _wr_command(0xCB);  
-  _wr_data(0x39); 
-  _wr_data(0x2C); 
-  _wr_data(0x00); 
-  _wr_data(0x34); 
-  _wr_data(0x02); 
- 
-  _wr_command(0xF7);  
-  _wr_data(0x20); 
-
-  _wr_command(0xEA);  
-  _wr_data(0x00); 
-  _wr_data(0x00); 
- 
-  _wr_command(ILI9340_PWCTR1);    //Power control 
-  _wr_data(0x23);   //VRH[5:0] 
- 
-  _wr_command(ILI9340_PWCTR2);    //Power control 
-  _wr_data(0x10);   //SAP[2:0];BT[3:0] 
- 
-  _wr_command(ILI9340_VMCTR1);    //VCM control 
-  _wr_data(0x3e); //�Աȶȵ���
-  _wr_data(0x28); 
-  
-  _wr_command(ILI9340_VMCTR2);    //VCM control2 
-  _wr_data(0x86);  //--
- 
-  _wr_command(ILI9340_MADCTL);    // Memory Access Control 
-  _wr_data(ILI9340_MADCTL_MX | ILI9340_MADCTL_BGR);
-
-  _wr_command(ILI9340_PIXFMT);    
-  _wr_data(0x55); 
-  
-  _wr_command(ILI9340_FRMCTR1);    
-  _wr_data(0x00);  
-  _wr_data(0x18); 
- 
-  _wr_command(ILI9340_DFUNCTR);    // Display Function Control 
-  _wr_data(0x08); 
-  _wr_data(0x82);
-  _wr_data(0x27);  
- 
-  _wr_command(0xF2);    // 3Gamma Function Disable 
-  _wr_data(0x00); 
- 
-  _wr_command(ILI9340_GAMMASET);    //Gamma curve selected 
-  _wr_data(0x01); 
- 
-  _wr_command(ILI9340_GMCTRP1);    //Set Gamma 
-  _wr_data(0x0F); 
-  _wr_data(0x31); 
-  _wr_data(0x2B); 
-  _wr_data(0x0C); 
-  _wr_data(0x0E); 
-  _wr_data(0x08); 
-  _wr_data(0x4E); 
-  _wr_data(0xF1); 
-  _wr_data(0x37); 
-  _wr_data(0x07); 
-  _wr_data(0x10); 
-  _wr_data(0x03); 
-  _wr_data(0x0E); 
-  _wr_data(0x09); 
-  _wr_data(0x00); 
-  
-  _wr_command(ILI9340_GMCTRN1);    //Set Gamma 
-  _wr_data(0x00); 
-  _wr_data(0x0E); 
-  _wr_data(0x14); 
-  _wr_data(0x03); 
-  _wr_data(0x11); 
-  _wr_data(0x07); 
-  _wr_data(0x31); 
-  _wr_data(0xC1); 
-  _wr_data(0x48); 
-  _wr_data(0x08); 
-  _wr_data(0x0F); 
-  _wr_data(0x0C); 
-  _wr_data(0x31); 
-  _wr_data(0x36); 
-  _wr_data(0x0F); 
-
-  _wr_command(ILI9340_SLPOUT);    //Exit Sleep 
-  _delay_ms(120); 		
-  _wr_command(ILI9340_DISPON);    //Display on
+  // commands are accepted 5ms after reset, but sleep out has to wait for
+  // 120ms, which is longer than sending the rest of the table takes
+  _delay_ms(120);
+
+  DC_HI;
+  _wr_begin();
+  _wr_commands(_init_cmds);
+  _wr_end();
 
   term.screen_width = ILI9340_TFTWIDTH;
   term.screen_height = ILI9340_TFTHEIGHT;
@@ -516,56 +382,93 @@ void ili9340_init(void) {
   term.front_color = 0xffff;
   term.cursor_x = term.cursor_y = 0;
   term.scroll_start = 0; 
+  term.scroll_top = term.scroll_bottom = 0;
+  term.scroll_flip = 0; // the init commands set rotation 0
+  term.win_valid = 0;
 }
 
 void ili9340_setScrollStart(uint16_t start){
+  struct ili9340 *t = &term;
+  uint16_t line = start;
+  if(t->scroll_flip){
+    // the panel counts lines from the bottom of the picture: the line at the
+    // top of the scroll area (as the panel sees it) is the one that shows at
+    // the bottom of it, so the lines above start are counted back from there
+    uint16_t height = ILI9340_TFTHEIGHT - (t->scroll_top + t->scroll_bottom);
+    line = t->scroll_bottom + (t->scroll_top + height - start) % height;
+  }
+  _wr_begin();
   _wr_command(0x37); // Vertical Scroll definition.
-  _wr_data16(start);
+  _wr_data16(line);
+  _wr_end();
   term.scroll_start = start; 
+  term.win_valid = 0;
 }
 
 
 void ili9340_setScrollMargins(uint16_t top, uint16_t bottom) {
-  // Did not pass in VSA as TFA+VSA=BFA must equal 320
+  // Did not pass in VSA as TFA+VSA+BFA must equal 320, the panel's own
+  // height whatever the rotation
+  term.scroll_top = top;
+  term.scroll_bottom = bottom;
+  _wr_begin();
 	_wr_command(0x33); // Vertical Scroll definition.
-  _wr_data16(top);
-  _wr_data16(ili9340_height()-(top+bottom));
-  _wr_data16(bottom); 
+  _wr_data16(term.scroll_flip?bottom:top);
+  _wr_data16(ILI9340_TFTHEIGHT-(top+bottom));
+  _wr_data16(term.scroll_flip?top:bottom); 
+  _wr_end();
+  term.win_valid = 0;
 }
 
-void ili9340_setAddrWindow(int16_t x0, int16_t y0, int16_t x1,
- int16_t y1) {
+// sets the address window and starts RAMWR inside an open transaction, so
+// that the pixels can follow without releasing CS
+static void _wr_window(int16_t x0, int16_t y0, int16_t x1, int16_t y1){
 	/*y0 = (y0 - term.scroll_start);
 	y1 = (y1 - term.scroll_start);
 	if(y0 < 0) y0 = term.screen_height - y0;
 	if(y1 < 0) y1 = term.screen_height - y0; */
 	//y0 = (y0 + term.scroll_start) % term.screen_height;
 	//y1 = (y1 + term.scroll_start) % term.screen_height;
+	struct ili9340 *t = &term;
 	
-  _wr_command(ILI9340_CASET); // Column addr set
-  _wr_data(x0 >> 8);
-  _wr_data(x0 & 0xFF);     // XSTART 
-  _wr_data(x1 >> 8);
-  _wr_data(x1 & 0xFF);     // XEND
-
-  _wr_command(ILI9340_PASET); // Row addr set
-  _wr_data(y0>>8);
-  _wr_data(y0);     // YSTART
-  _wr_data(y1>>8);
-  _wr_data(y1);     // YEND
+	if(!t->win_valid || x0 != t->win_x0 || x1 != t->win_x1){
+		_wr_command(ILI9340_CASET); // Column addr set
+		_wr_data(x0 >> 8);
+		_wr_data(x0 & 0xFF);     // XSTART 
+		_wr_data(x1 >> 8);
+		_wr_data(x1 & 0xFF);     // XEND
+		t->win_x0 = x0;
+		t->win_x1 = x1;
+	}
+
+	if(!t->win_valid || y0 != t->win_y0 || y1 != t->win_y1){
+		_wr_command(ILI9340_PASET); // Row addr set
+		_wr_data(y0>>8);
+		_wr_data(y0);     // YSTART
+		_wr_data(y1>>8);
+		_wr_data(y1);     // YEND
+		t->win_y0 = y0;
+		t->win_y1 = y1;
+	}
+	t->win_valid = 1;
+	t->fill_next = ILI9340_NO_FILL;
 
   _wr_command(ILI9340_RAMWR); // write to RAM
 }
 
+void ili9340_setAddrWindow(int16_t x0, int16_t y0, int16_t x1,
+ int16_t y1) {
+	_wr_begin();
+	_wr_window(x0, y0, x1, y1);
+	_wr_end();
+}
 
-void ili9340_pushColor(uint16_t color) {
-  DC_HI;
-  CS_LO; 
-
-  _spi_write(color >> 8);
-  _spi_write(color);
 
-	CS_HI; 
+void ili9340_pushColor(uint16_t color) {
+  term.fill_next = ILI9340_NO_FILL;
+  _wr_begin();
+  _wr_data16(color);
+  _wr_end();
 }
 uint16_t ili9340_width(void){
 	return term.screen_width;
@@ -587,20 +490,42 @@ void ili9340_fillRect(uint16_t x, uint16_t y, uint16_t w, uint16_t h,
   if((x + w - 1) >= t->screen_width)  w = t->screen_width  - x;
   if((y + h - 1) >= t->screen_height) h = t->screen_height - y;
 
-  ili9340_setAddrWindow(x, y, x+w-1, y+h-1);
+  uint8_t hi = color >> 8, lo = color;
 
+  _wr_begin();
+  _wr_window(x, y, x+w-1, y+h-1);
+  // the window wraps to the next line by itself, so the whole rectangle is
+  // one run of pixels
+  _spi_stream_fill(hi, lo, (uint32_t)w * h);
+  _wr_end();
+}
+
+// fills lines [from, from + n) of a rectangle. When the previous call to
+// this function stopped at line from of a rectangle with the same columns
+// and bottom, the pixels are streamed on with RAMWRC (write memory
+// continue) instead of setting up a new window, so a large area can be
+// filled in pieces for the cost of a single window
+void ili9340_fillLines(uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+  uint16_t from, uint16_t n, uint16_t color) {
+	struct ili9340 *t = &term;
+
+  if((x + w - 1) >= t->screen_width)  w = t->screen_width  - x;
+  if((y + h - 1) >= t->screen_height) h = t->screen_height - y;
+  if(from >= h) return;
+  if(from + n > h) n = h - from;
+
+  uint16_t x1 = x + w - 1, y0 = y + from, y1 = y + h - 1;
   uint8_t hi = color >> 8, lo = color;
 
-  DC_HI; 
-  CS_LO; 
-  
-  for(y=h; y>0; y--) {
-    for(x=w; x>0; x--) {
-      _spi_write(hi);
-      _spi_write(lo);
-    }
-  }
-  CS_HI; 
+  _wr_begin();
+  if(t->win_valid && t->fill_next == y0 &&
+		x == t->win_x0 && x1 == t->win_x1 && y1 == t->win_y1)
+		_wr_command(ILI9340_RAMWRC);
+  else
+		_wr_window(x, y0, x1, y1);
+  _spi_stream_fill(hi, lo, (uint32_t)w * n);
+  t->fill_next = y0 + n;
+  _wr_end();
 }
 
 void ili9340_setBackColor(uint16_t col){
@@ -617,33 +542,24 @@ void ili9340_setFrontColor(uint16_t col){
 }
 
 void ili9340_drawChar(uint16_t x, uint16_t y, uint8_t ch){
+	ili9340_drawChars(x, y, &ch, 1);
+}
+
+// draws a row of characters through a single address window. The window
+// spans all glyphs and the pixels are streamed one scanline at a time across
+// the whole run, so a full line costs one window setup instead of one per
+// character
+void ili9340_drawChars(uint16_t x, uint16_t y, const uint8_t *chars, uint8_t n){
 	struct ili9340 *t = &term;
-	
-	ili9340_setAddrWindow(x, y, x+t->char_width-1, y + t->char_height);
+	if(!n) return;
 
-	DC_HI;
-	CS_LO;
+	_wr_begin();
+	_wr_window(x, y, x + n * t->char_width - 1, y + t->char_height - 1);
 
-	// character glyph buffer
-	char _buf[5]; 
-	for(int j = 0; j < 5; j++){
-		_buf[j] = pgm_read_byte(&font[ch * 5 + j]);
+	for(uint8_t b = 0; b < 8; b++){
+		_spi_stream_glyphs(chars, n, b, t->front_color, t->back_color);
 	}
-	for(int b = 0; b < 8; b++){
-		// draw 5 pixels for each column of the glyph
-		for(int j = 0; j < 5; j++){
-			uint16_t pix = t->back_color;
-			if(_buf[j] & _BV(b))
-				pix = t->front_color;
-			_spi_write(pix >> 8);
-			_spi_write(pix);
-		}
-		
-		// draw one more separator pixel
-		_spi_write(t->back_color >> 8);
-		_spi_write(t->back_color);
-	}
-	CS_HI;
+	_wr_end();
 }
 
 void ili9340_drawString(uint16_t x, uint16_t y, const char *text){
@@ -673,22 +589,20 @@ void ili9340_drawFastHLine(int16_t x, int16_t y, int16_t w,
   if((x >= t->screen_width) || (y >= t->screen_height)) return;
   if((x+w-1) >= t->screen_width)  w = t->screen_width-x;
   
-  ili9340_setAddrWindow(x, y, x+w-1, y);
-
   uint8_t hi = color >> 8, lo = color;
-  DC_HI;
-  CS_LO; 
-  while (w--) {
-    _spi_write(hi);
-    _spi_write(lo);
-  }
-  CS_HI; 
+  _wr_begin();
+  _wr_window(x, y, x+w-1, y);
+  _spi_stream_fill(hi, lo, w);
+  _wr_end();
 }
 
 void ili9340_setRotation(uint8_t m) {
 	struct ili9340 *t = &term; 
+	t->win_valid = 0; // MADCTL changes what the column and page ranges mean
+  _wr_begin();
   _wr_command(ILI9340_MADCTL);
   int rotation = m % 4; // can't be higher than 3
+  t->scroll_flip = (rotation == 2);
   switch (rotation) {
    case 0:
      _wr_data(ILI9340_MADCTL_MX | ILI9340_MADCTL_BGR);
@@ -711,5 +625,6 @@ void ili9340_setRotation(uint8_t m) {
      t->screen_height = ILI9340_TFTWIDTH;
      break;
   }
+  _wr_end();
 }
 
@@ -52,6 +52,7 @@
 #define ILI9340_PASET   0x2B
 #define ILI9340_RAMWR   0x2C
 #define ILI9340_RAMRD   0x2E
+#define ILI9340_RAMWRC  0x3C
 
 #define ILI9340_PTLAR   0x30
 #define ILI9340_MADCTL  0x36
@@ -118,10 +119,13 @@ void ili9340_drawFastHLine(int16_t x, int16_t y, int16_t h,
 void ili9340_setRotation(uint8_t m) ;
 void ili9340_drawString(uint16_t x, uint16_t y, const char *text);
 void ili9340_drawChar(uint16_t x, uint16_t y, uint8_t c);
+void ili9340_drawChars(uint16_t x, uint16_t y, const uint8_t *chars, uint8_t n);
 void ili9340_setBackColor(uint16_t col); 
 void ili9340_setFrontColor(uint16_t col);
 void ili9340_fillRect(uint16_t x, uint16_t y, uint16_t w, uint16_t h,
   uint16_t color);
+void ili9340_fillLines(uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+  uint16_t from, uint16_t n, uint16_t color);
 
 void ili9340_setScrollStart(uint16_t start); 
 void ili9340_setScrollMargins(uint16_t top, uint16_t bottom);
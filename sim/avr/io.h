@@ -0,0 +1,55 @@
+/**
+	Host stand-in for <avr/io.h> used by the simulator build.
+
+	Only the registers that ili9340.c and vt100.c touch are provided. Plain
+	registers are ordinary variables; PORTB, SPDR and SPSR go through
+	accessor functions so that the simulated panel (sim.c) sees every SPI
+	byte together with the state of the CS and DC lines when it was sent.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#ifndef _BV
+#define _BV(bit) (1 << (bit))
+#endif
+
+extern volatile uint8_t sim_reg_ddrb, sim_reg_ddrd, sim_reg_portd;
+extern volatile uint8_t sim_reg_spcr;
+
+volatile uint8_t *sim_portb(void);
+volatile uint8_t *sim_spdr(void);
+volatile uint8_t *sim_spsr(void);
+
+#define DDRB sim_reg_ddrb
+#define PORTB (*sim_portb())
+#define DDRD sim_reg_ddrd
+#define PORTD sim_reg_portd
+
+#define SPCR sim_reg_spcr
+#define SPDR (*sim_spdr())
+#define SPSR (*sim_spsr())
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PD5 5
+
+#define SPR0 0
+#define SPR1 1
+#define CPHA 2
+#define CPOL 3
+#define MSTR 4
+#define DORD 5
+#define SPE 6
+#define SPIE 7
+
+#define SPI2X 0
+#define WCOL 6
+#define SPIF 7
@@ -0,0 +1,21 @@
+/**
+	Host stand-in for <avr/pgmspace.h>: flash and ram share one address space.
+	Like the real header it pulls in <avr/io.h>, which ili9340.c relies on.
+	Flash reads go through sim.c so that they can be counted (one per lpm).
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <avr/io.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+uint8_t sim_pgm_read_byte(const void *addr);
+uint16_t sim_pgm_read_word(const void *addr);
+const void *sim_pgm_read_ptr(const void *addr);
+
+#define pgm_read_byte(addr) sim_pgm_read_byte(addr)
+#define pgm_read_word(addr) sim_pgm_read_word(addr)
+#define pgm_read_ptr(addr) sim_pgm_read_ptr(addr)
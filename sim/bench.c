@@ -0,0 +1,1087 @@
+/**
+	This file is part of FORTMAX.
+
+	FORTMAX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	FORTMAX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with FORTMAX.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright: Martin K. Schröder (info@fortmax.se) 2014
+*/
+
+/**
+	Throughput benchmark for the vt100 emulator running on the simulated panel.
+
+	Usage: vt100_bench [-b] [-p] [-c] [-d chunks] [-u baud [-r bytes]] [-w workload] [-o screen.ppm] [file...]
+
+	Without files, the built in workloads are replayed (see _workloads). Files are replayed as captured byte streams (for example the
+	output of "script -q"). For every stream we report host throughput
+	(bytes/s, glyphs/s), the share of glyphs that were skipped because the
+	screen already showed them, and the SPI traffic the same stream would cause on
+	the panel, with the time that traffic takes at F_CPU/2 SPI clock.
+
+	Streams are fed through vt100_write in the chunks a uart reader would see,
+	and the display is flushed after every chunk as if the uart queue had run
+	empty. -d n flushes only after every n chunks (output arriving faster than
+	it is drawn), -b feeds the stream one byte at a time through vt100_putc.
+	-p splits the display into two panes (top and bottom half) and feeds
+	every chunk to both, drawing them with vt100_flush_all; the byte and
+	glyph counts are then those of both panes together.
+
+	-u baud replays the streams as they would arrive on a uart at that
+	rate, through the main loop of demo.cpp with a -r byte receive buffer
+	(by default the smallest one demo.cpp accepts for the rate), and
+	reports the end-to-end rate, from the first byte on the wire until the
+	screen shows the end of the stream, and the bytes lost to a full
+	buffer, with the pipelined _spi_write and without it (see _uart_run).
+
+	The built in workloads are synthetic: small seeded generators that
+	write the kind of output their name says, not recorded sessions. Some of
+	them are regression streams for bugs that were fixed, with the hash of
+	the screen they must end on (or of the screens at several points of the
+	stream), taken from the terminal when they were added. -c replays just
+	those, each one bytewise and with -d 1 and -d 9, and exits with 1 if any
+	of them shows a different screen. The edit and colors streams are also
+	checked against a screen worked out without the terminal (see _ref_feed).
+
+	Before the streams, the time from reset to the first glyph on screen is
+	reported, following the startup in demo.cpp. max_ms is the SPI time of
+	the longest single vt100_write/vt100_flush(1)/vt100_putc call, during
+	which the uart buffer is not read.
+*/
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sim.h"
+#include "ili9340.h"
+#include "vt100.h"
+#include "font5x7.h"
+
+struct buffer {
+	uint8_t *data;
+	size_t len, size;
+};
+
+static void _buf_put(struct buffer *b, const char *str, size_t len){
+	if(b->len + len > b->size){
+		b->size = (b->len + len) * 2;
+		b->data = realloc(b->data, b->size);
+		if(!b->data){ perror("realloc"); exit(1); }
+	}
+	memcpy(b->data + b->len, str, len);
+	b->len += len;
+}
+
+static void _buf_printf(struct buffer *b, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void _buf_printf(struct buffer *b, const char *fmt, ...){
+	char tmp[256];
+	va_list va;
+	va_start(va, fmt);
+	int n = vsnprintf(tmp, sizeof(tmp), fmt, va);
+	va_end(va);
+	if(n > 0) _buf_put(b, tmp, (size_t)n < sizeof(tmp)?(size_t)n:sizeof(tmp) - 1);
+}
+
+// deterministic so that runs can be compared
+static uint32_t _seed = 1;
+static uint32_t _rand(void){
+	_seed = _seed * 1103515245u + 12345u;
+	return (_seed >> 16) & 0x7fff;
+}
+
+static const char *_words[] = {
+	"kernel:", "usb", "device", "eth0:", "link", "up", "connected", "INFO",
+	"WARN", "read", "write", "sector", "0x1f2e", "done", "timeout", "retry",
+	"[ok]", "systemd[1]:", "Started", "session", "mounted", "/dev/sda1"
+};
+
+// plain text log lines, the way `cat file.log` looks on the wire
+static void _gen_cat(struct buffer *b){
+	for(int l = 0; l < 2000; l++){
+		int col = 6;
+		_buf_printf(b, "%05d ", l);
+		while(1){
+			const char *w = _words[_rand() % (sizeof(_words) / sizeof(_words[0]))];
+			int len = strlen(w) + 1;
+			if(col + len > 39) break;
+			_buf_printf(b, "%s ", w);
+			col += len;
+		}
+		_buf_put(b, "\r\n", 2);
+	}
+}
+
+// full screen repaints where most of the screen stays the same between frames
+static void _gen_htop(struct buffer *b){
+	_buf_put(b, "\e[2J", 4);
+	for(int frame = 0; frame < 60; frame++){
+		_buf_put(b, "\e[H", 3);
+		_buf_printf(b, "\e[1;1H\e[32;40m  CPU[\e[31m%-22.*s\e[32m%5.1f%%]",
+			(int)(_rand() % 22), "||||||||||||||||||||||", (_rand() % 1000) / 10.0);
+		_buf_printf(b, "\e[2;1H\e[32;40m  Mem[\e[33m%-22s\e[32m%4dM/992M]",
+			"||||||||||||", 300 + frame);
+		_buf_printf(b, "\e[3;1H\e[37;40m  Tasks: 42, 1 running    Load: 0.%02d",
+			(int)(_rand() % 100));
+		_buf_printf(b, "\e[5;1H\e[30;46m  PID USER     CPU%% MEM%% COMMAND         \e[37;40m");
+		for(int row = 0; row < 30; row++){
+			_buf_printf(b, "\e[%d;1H%5d %-8s %4.1f %4.1f %-15s", row + 6,
+				100 + row * 7, (row & 1)?"root":"daemon",
+				(row == (frame % 30))?(_rand() % 100) / 10.0:0.0,
+				1.0 + row / 10.0, (row & 2)?"/usr/sbin/sshd":"kworker/0:1");
+		}
+		_buf_printf(b, "\e[40;1H\e[30;46mF1Help F2Setup F3Search F10Quit   \e[37;40m");
+	}
+}
+
+// interactive shell: typing with readline style edits and short outputs
+static void _gen_shell(struct buffer *b){
+	static const char *cmds[] = {
+		"ls -la", "cd /var/log", "grep -r error .", "make -j4", "git status",
+		"vi vt100.c", "dmesg | tail"
+	};
+	for(int i = 0; i < 200; i++){
+		const char *cmd = cmds[_rand() % (sizeof(cmds) / sizeof(cmds[0]))];
+		_buf_printf(b, "\e[32muser@avr\e[37m:\e[34m~\e[37m$ ");
+		// typed one byte at a time, with a typo that is corrected
+		for(const char *c = cmd; *c; c++) _buf_put(b, c, 1);
+		_buf_put(b, "xx\b\b\e[K", 7);
+		// cursor back into the line, insert and delete a character
+		_buf_put(b, "\b\b\e[1@z\b\e[P", 11);
+		_buf_put(b, "\r\n", 2);
+		for(int l = _rand() % 4; l > 0; l--){
+			_buf_printf(b, "-rw-r--r-- 1 root root %5d file%d.txt\r\n",
+				(int)(_rand() % 99999), l);
+		}
+	}
+}
+
+// clear screen heavy output (watch(1), menus)
+static void _gen_clear(struct buffer *b){
+	for(int i = 0; i < 50; i++){
+		_buf_put(b, "\e[H\e[2J", 7);
+		for(int l = 0; l < 10; l++){
+			_buf_printf(b, "\e[%d;1Hitem %d of menu page %d\e[K", l + 2, l, i);
+		}
+		_buf_put(b, "\e[20;1H\e[J", 10);
+		_buf_put(b, "\e[5;1H\e[2K\e[1K\e[0K", 19);
+	}
+}
+
+// newline heavy output: short lines as from seq(1) or ls -1, then the same
+// inside a scroll region and moving with index / reverse index (ESC D, ESC M)
+static void _gen_lines(struct buffer *b){
+	for(int l = 0; l < 3000; l++)
+		_buf_printf(b, "%d\r\n", l);
+	_buf_put(b, "\e[5;36r\e[20;1H", 13);
+	for(int l = 0; l < 1000; l++)
+		_buf_printf(b, "%s\n", _words[_rand() % (sizeof(_words) / sizeof(_words[0]))]);
+	for(int l = 0; l < 500; l++)
+		_buf_put(b, (_rand() & 1)?"\eD":"\eM", 2);
+	_buf_put(b, "\e[r", 3);
+}
+
+// scroll region set while the screen is scrolled (78 lines into 40), then
+// written and scrolled inside the new region
+static void _gen_decstbm(struct buffer *b){
+	for(int l = 0; l < 78; l++)
+		_buf_printf(b, "line %d\r\n", l);
+	_buf_printf(b, "\e[31;41r\e[40;1Hbottom");
+	for(int l = 0; l < 20; l++)
+		_buf_printf(b, "\r\nregion %d", l);
+	_buf_printf(b, "\e[r\e[Htop\e[40;1H\r\nafter");
+}
+
+// scroll region with a top of 0, reverse index on its first line
+static void _gen_decstbm0(struct buffer *b){
+	for(int l = 0; l < 12; l++)
+		_buf_printf(b, "line %d\r\n", l);
+	_buf_printf(b, "\e[0;10r\e[H\eMhello\e[;5r\e[5;1H\r\nfive\e[r");
+}
+
+// text past the right edge with wrapping off and below the last line, where
+// there are no cells to keep it in, between cursor moves, line erases and
+// scrolling. Nothing of it may show, however the flushes fall
+static void _gen_offgrid(struct buffer *b){
+	for(int l = 0; l < 400; l++){
+		switch(_rand() % 5){
+			case 0: _buf_printf(b, "\e[%d;%dH", _rand() % 60, _rand() % 60); break;
+			case 1: _buf_printf(b, "\e[%dK", _rand() % 3); break;
+			case 2: _buf_printf(b, "\r\n"); break;
+			case 3: _buf_printf(b, "\e[?7%c", (_rand() & 1)?'h':'l'); break;
+			case 4: _buf_printf(b, "\e[%dm", 31 + _rand() % 7); break;
+		}
+		for(int w = _rand() % 12; w > 0; w--)
+			_buf_printf(b, "%s ", _words[_rand() % (sizeof(_words) / sizeof(_words[0]))]);
+	}
+}
+
+#define _WORD() _words[_rand() % (sizeof(_words) / sizeof(_words[0]))]
+
+// inserts and deletes lines at random rows of random scroll regions on a
+// full screen, with newlines that scroll the region in between, so that
+// both the hardware scroll and the copying path of CSI L and M are taken
+static void _gen_ildl(struct buffer *b){
+	for(int l = 0; l < 40; l++)
+		_buf_printf(b, "\e[%d;1H%d %s %s", l + 1, l, _WORD(), _WORD());
+	for(int l = 0; l < 400; l++){
+		switch(_rand() % 8){
+			case 0: {
+				int top = 1 + _rand() % 20;
+				_buf_printf(b, "\e[%d;%dr", top, top + 2 + _rand() % 20);
+				break;
+			}
+			case 1: _buf_printf(b, "\e[r"); break;
+			case 2: _buf_printf(b, "\e[%dL", 1 + _rand() % 4); break;
+			case 3: _buf_printf(b, "\e[%dM", 1 + _rand() % 4); break;
+			case 4: _buf_printf(b, "\e[%dL", 1 + _rand() % 12); break;
+			case 5: _buf_printf(b, "\e[%dM", 1 + _rand() % 12); break;
+			case 6: _buf_printf(b, "\e[%d;1H", 1 + _rand() % 40); break;
+			case 7: _buf_printf(b, "\r\n\e[3%dm%s\e[m", _rand() % 8, _WORD()); break;
+		}
+		_buf_printf(b, "%s ", _WORD());
+	}
+}
+
+// line editing: 60 lines of partly colored text (the screen scrolls), then
+// characters inserted, deleted and overwritten at random places, in and out
+// of color, the way a line editor redraws around the cursor
+static void _gen_edit(struct buffer *b){
+	for(int l = 0; l < 60; l++)
+		_buf_printf(b, "%s \e[3%dm%s\e[m %s %s\r\n", _WORD(), 1 + _rand() % 7, _WORD(), _WORD(), _WORD());
+	for(int l = 0; l < 600; l++){
+		_buf_printf(b, "\e[%d;%dH", 1 + _rand() % 40, 1 + _rand() % 40);
+		switch(_rand() % 4){
+			case 0: _buf_printf(b, "\e[%d@", 1 + _rand() % 6); break;
+			case 1: _buf_printf(b, "\e[%dP", 1 + _rand() % 6); break;
+			case 2: _buf_printf(b, "\e[%d@\e[3%dm%s\e[m", 3, 1 + _rand() % 7, "abc"); break;
+			case 3: _buf_printf(b, "%s", _WORD()); break;
+		}
+	}
+}
+
+// lines with a colored word and a word on a colored background, the most
+// colored runs a row of single byte cells keeps apart, that are then moved
+// around: characters inserted and deleted in front of them, lines inserted
+// and deleted and scroll regions scrolled. It starts with red text moved
+// right under blue text on the same row. Both cell layouts have to end on
+// the same screens
+static void _gen_colors(struct buffer *b){
+	_buf_printf(b, "\e[31mRED \e[34mBLUE\e[m\e[1;1H\e[1@");
+	for(int l = 0; l < 40; l++)
+		_buf_printf(b, "\r\n%s \e[3%dm%s\e[m %s \e[4%dm%s\e[m", _WORD(), 1 + l % 7, _WORD(),
+			_WORD(), 1 + (l + 3) % 7, _WORD());
+	for(int l = 0; l < 300; l++){
+		_buf_printf(b, "\e[%d;%dH", 1 + _rand() % 40, 1 + _rand() % 40);
+		switch(_rand() % 5){
+			case 0: _buf_printf(b, "\e[%d@", 1 + _rand() % 6); break;
+			case 1: _buf_printf(b, "\e[%dP", 1 + _rand() % 6); break;
+			case 2: _buf_printf(b, "\e[%dL", 1 + _rand() % 4); break;
+			case 3: _buf_printf(b, "\e[%dM", 1 + _rand() % 4); break;
+			case 4: {
+				int top = 1 + _rand() % 20, bottom = top + 2 + _rand() % 20;
+				_buf_printf(b, "\e[%d;%dr\e[%d;1H\n\n\e[r", top, bottom, bottom);
+				break;
+			}
+		}
+	}
+}
+
+// control strings and sequences that must leave nothing on the screen:
+// OSC (BEL and ST terminated), DCS, APC, SOS and PM strings, a character
+// set selection, private and intermediate sequences that are not supported
+// and a sequence with more parameters than are kept
+static const char *_strings[] = {
+	"\e]0;user@host: ~/src\a", "\e]2;title\e\\", "\eP1$r0;1m\e\\", "\e_apc text\e\\",
+	"\eXsos text\e\\", "\e^pm text\e\\", "\e(B", "\e[?25l", "\e[?25h", "\e[>c",
+	"\e[!p", "\e[0;0;0;0;0;0;0;0;0;0;0;0m"
+};
+
+// colored lines of text with the strings above between them and inside
+// the lines. It ends on the same screen as the text alone (99e888f7)
+static void _gen_strings(struct buffer *b){
+	for(int l = 0; l < 120; l++){
+		const char *str = _strings[l % (sizeof(_strings) / sizeof(_strings[0]))];
+		_buf_printf(b, "%d %s%s \e[3%dm%s\e[m%s %s\r\n", l, str, _WORD(), 1 + l % 7, _WORD(), str, _WORD());
+	}
+}
+
+// sequences that the parser takes through all of its intermediate states
+static const char *_sequences[] = {
+	"\e[12;34H", "\e[?25;7l", "\e[1;31;44m", "\e(B", "\e#8", "\e[>0c", "\e[ q",
+	"\e[1$0x", "\eP1$r0m\e\\", "\e]0;title\a", "\e_apc\e\\"
+};
+
+// every sequence above cut off after each of its bytes, so in every state
+// of the parser, by CAN, SUB or the ESC of the next sequence (a \e[m, which
+// changes nothing), with a word of text after each. It ends on the same
+// screen as the text alone (d8b81a07)
+static void _gen_aborts(struct buffer *b){
+	int cut = 0;
+	for(size_t c = 0; c < sizeof(_sequences) / sizeof(_sequences[0]); c++){
+		for(size_t n = 1; n < strlen(_sequences[c]); n++, cut++){
+			static const char *abort[] = {"\x18", "\x1a", "\e[m"};
+			_buf_put(b, _sequences[c], n);
+			_buf_printf(b, "%s%s ", abort[cut % 3], _WORD());
+			if(cut % 6 == 5) _buf_printf(b, "\r\n");
+		}
+	}
+}
+
+// screen is the hash of the screen the stream ends on (whole screen
+// terminal, [0] in portrait and [1] in the landscape of VT100_ROTATION=1),
+// or 0 where it is not checked by -c. With screens > 1 it
+// is a hash over the screens after the first 1/screens, 2/screens, ... of
+// the stream. Where single byte cells can not keep the colors of the stream
+// (more colored runs on a row than they keep apart) text is the same over
+// which pixels are lit (_text_hash), which they check instead. The screens
+// were taken from the terminal when the workload was added, so they catch
+// changes of the output. The final screen of a workload with reference set
+// is also compared with one worked out without the terminal (_ref_feed)
+static const struct workload {
+	const char *name;
+	void (*generate)(struct buffer *b);
+	uint32_t screen[2], text[2];
+	int screens, reference;
+} _workloads[] = {
+	{"cat", _gen_cat, {0, 0}, {0, 0}, 1, 0},
+	{"htop", _gen_htop, {0, 0}, {0, 0}, 1, 0},
+	{"shell", _gen_shell, {0, 0}, {0, 0}, 1, 0},
+	{"clear", _gen_clear, {0, 0}, {0, 0}, 1, 0},
+	{"lines", _gen_lines, {0, 0}, {0, 0}, 1, 0},
+	{"decstbm", _gen_decstbm, {0x1e613b25, 0x575d07dd}, {0, 0}, 1, 0},
+	{"decstbm0", _gen_decstbm0, {0xd0c173db, 0x67d990ab}, {0, 0}, 1, 0},
+	{"offgrid", _gen_offgrid, {0xd6431b37, 0xa6495c74}, {0, 0}, 1, 0},
+	{"ildl", _gen_ildl, {0x41242e89, 0x4c910076}, {0, 0}, 40, 0},
+	{"edit", _gen_edit, {0x36ed723e, 0x254f3b40}, {0x19a2a690, 0xe77257f1}, 60, 1},
+	{"colors", _gen_colors, {0x3754fd5b, 0x2ef3c4f0}, {0, 0}, 60, 1},
+	{"strings", _gen_strings, {0x99e888f7, 0xbf6f488d}, {0, 0}, 1, 0},
+	{"aborts", _gen_aborts, {0xe39d8927, 0xcdbc1e67}, {0, 0}, 40, 0},
+};
+
+static void _respond(char *str){
+	(void)str;
+}
+
+// counts bytes that end up as glyphs (printable, outside escape sequences)
+static uint32_t _count_glyphs(const uint8_t *data, size_t len){
+	uint32_t glyphs = 0;
+	enum { GROUND, ESC, CSI } st = GROUND;
+	for(size_t c = 0; c < len; c++){
+		uint8_t ch = data[c];
+		switch(st){
+			case GROUND:
+				if(ch == 0x1b) st = ESC;
+				else if(ch >= 0x20 && ch < 0x7f) glyphs++;
+				break;
+			case ESC:
+				st = (ch == '[')?CSI:GROUND;
+				break;
+			case CSI:
+				if(ch >= 0x40 && ch <= 0x7e) st = GROUND;
+				break;
+		}
+	}
+	return glyphs;
+}
+
+static double _now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int _bytewise = 0;
+static int _drain = 1;
+static int _panes = 0;
+
+#if VT100_INSTANCES > 1
+// the default terminal of the boot measurement, and the panes of -p
+static vt100_t *_term, *_pane[2];
+#endif
+
+static void _setup(void){
+	sim_reset();
+	ili9340_init();
+	ili9340_setRotation(0);
+#if VT100_INSTANCES > 1
+	if(_panes){
+		// panes only: the default terminal and the panes of the last stream
+		// are closed, so the new panes take the first two terminals
+		// (the screen size of the terminal's rotation, which vt100_open sets
+		// in builds with a fixed one)
+		uint16_t half = VT100_SCREEN_HEIGHT / 2;
+		vt100_close(_term);
+		for(int p = 0; p < 2; p++){
+			if(_pane[p]) vt100_close(_pane[p]);
+			_pane[p] = vt100_open(0, p * half, VT100_SCREEN_WIDTH, half, _respond);
+		}
+		vt100_flush_all(VT100_FLUSH_ALL);
+		sim_clear_stats();
+		memset(&vt100_stats, 0, sizeof(vt100_stats));
+		return;
+	}
+	_term = vt100_init(_respond);
+#else
+	vt100_init(_respond);
+#endif
+	vt100_flush(VT100_FLUSH_ALL);
+	sim_clear_stats();
+	memset(&vt100_stats, 0, sizeof(vt100_stats));
+}
+
+// pixel (x, y) of the picture the way the terminal draws it, in the rotation
+// of the build (sim_screen_pixel takes the display in portrait)
+static uint16_t _pixel(uint16_t x, uint16_t y){
+#if defined(VT100_ROTATION) && VT100_ROTATION == 1
+	return sim_screen_pixel(ILI9340_TFTWIDTH - 1 - y, x);
+#elif defined(VT100_ROTATION) && VT100_ROTATION == 2
+	return sim_screen_pixel(ILI9340_TFTWIDTH - 1 - x, ILI9340_TFTHEIGHT - 1 - y);
+#elif defined(VT100_ROTATION) && VT100_ROTATION == 3
+	return sim_screen_pixel(y, ILI9340_TFTHEIGHT - 1 - x);
+#else
+	return sim_screen_pixel(x, y);
+#endif
+}
+
+// Boot latency: panel reset and init and the terminal reset of demo.cpp,
+// then one character and vt100_flush(1) steps (as the main loop does them)
+// until the character shows. The time is the delays plus the SPI transfer
+// time; the cpu is assumed to keep the bus busy, as the pipelined
+// _spi_write does
+static int _glyph_shown(void){
+	for(uint16_t y = 0; y < 8; y++)
+		for(uint16_t x = 0; x < 6; x++)
+			if(_pixel(x, y)) return 1;
+	return 0;
+}
+
+static void _boot(void){
+	static const char reset[] = "\ec\e[?7l$";
+	sim_reset();
+	ili9340_init();
+	ili9340_setRotation(0);
+#if VT100_INSTANCES > 1
+	_term = vt100_init(_respond);
+#else
+	vt100_init(_respond);
+#endif
+	vt100_write((const uint8_t*)reset, strlen(reset));
+	while(!_glyph_shown() && vt100_flush(1));
+
+	double spi_ms = (double)sim_stats.spi_bytes * SIM_CYCLES_PER_SPI_BYTE * 1000 / F_CPU;
+	printf("boot: %.1f ms to the first glyph (%.1f ms of delays, %u SPI bytes in %.1f ms)\n",
+		sim_stats.delay_us / 1000 + spi_ms, sim_stats.delay_us / 1000,
+		sim_stats.spi_bytes, spi_ms);
+}
+
+// Nothing empties the uart buffer while a vt100 call runs, so the longest
+// call (in SPI bytes) bounds how much input has to be buffered
+static uint32_t _worst, _mark;
+
+static void _step(void){
+	uint32_t spi = sim_stats.spi_bytes - _mark;
+	if(spi > _worst) _worst = spi;
+	_mark = sim_stats.spi_bytes;
+}
+
+// flushes everything one step at a time, like the main loop of demo.cpp
+static void _flush(void){
+#if VT100_INSTANCES > 1
+	if(_panes){
+		while(vt100_flush_all(1)) _step();
+		_step();
+		return;
+	}
+#endif
+	while(vt100_flush(1)) _step();
+	_step();
+}
+
+// feeds bytes to terminal t (0 for the default one) and returns how many
+// it took
+static size_t _take(vt100_t *t, const uint8_t *data, size_t len){
+	size_t n;
+#if VT100_INSTANCES > 1
+	if(t) n = vt100_term_write(t, data, len);
+	else
+#endif
+	n = vt100_write(data, len);
+	_step();
+	return n;
+}
+
+// feeds all bytes to terminal t. When the input has to wait for a row to be
+// drawn, one flush step is done before the rest is passed again, as the
+// main loop of demo.cpp does
+static void _give(vt100_t *t, const uint8_t *data, size_t len){
+	size_t n;
+	while((n = _take(t, data, len)) < len){
+		data += n;
+		len -= n;
+#if VT100_INSTANCES > 1
+		if(t) vt100_term_flush(t, 1);
+		else
+#endif
+		vt100_flush(1);
+		_step();
+	}
+}
+
+// feeds bytes to the terminal, or to both panes
+static void _write(const uint8_t *data, size_t len){
+#if VT100_INSTANCES > 1
+	if(_panes){
+		for(int p = 0; p < 2; p++){
+			if(_bytewise){
+				vt100_term_putc(_pane[p], *data);
+				_step();
+			}
+			else _give(_pane[p], data, len);
+		}
+		return;
+	}
+#endif
+	if(_bytewise){
+		vt100_putc(*data);
+		_step();
+	}
+	else _give(0, data, len);
+}
+
+// chunk size used for vt100_write, roughly what accumulates in the uart
+// buffer while a line is being drawn
+#define BENCH_CHUNK 64
+
+// feeds a stream to a freshly reset terminal and draws everything
+static void _feed(const uint8_t *data, size_t len){
+	_setup();
+
+	_worst = _mark = 0;
+	if(_bytewise){
+		for(size_t c = 0; c < len; c++) _write(data + c, 1);
+	} else {
+		int chunks = 0;
+		for(size_t c = 0; c < len; c += BENCH_CHUNK){
+			_write(data + c, (len - c < BENCH_CHUNK)?(len - c):BENCH_CHUNK);
+			if(++chunks % _drain == 0) _flush();
+		}
+		_flush();
+	}
+}
+
+static void _run(const char *name, const uint8_t *data, size_t len){
+	double start = _now();
+	_feed(data, len);
+	double host = _now() - start;
+	if(host <= 0) host = 1e-9;
+
+	struct sim_stats st = sim_stats;
+	uint32_t glyphs = _count_glyphs(data, len);
+	if(_panes){
+		len *= 2;
+		glyphs *= 2;
+	}
+	double spi_s = (double)st.spi_bytes * SIM_CYCLES_PER_SPI_BYTE / F_CPU;
+
+	printf("%-8s %9zu %8u %6.1f%% %10.0f %10.0f %11u %7.1f %8u %8u %9.0f %10u %6.2f  %08x\n",
+		name, len, glyphs,
+		vt100_stats.glyphs?100.0 * vt100_stats.elided / vt100_stats.glyphs:0.0,
+		len / host, glyphs / host,
+		st.spi_bytes, (double)st.spi_bytes / (len?len:1), st.windows,
+		st.cs_toggles, spi_s > 0?len / spi_s:0.0, st.flash_reads,
+		(double)_worst * SIM_CYCLES_PER_SPI_BYTE * 1000 / F_CPU,
+		sim_screen_hash());
+	if(st.spi_violations)
+		printf("%-8s %u SPI timing violations\n", name, st.spi_violations);
+}
+
+// -u: the main loop of demo.cpp fed by a uart at a given baud rate. The SPI
+// traffic is simulated exactly, the cpu time around it is a model (there is
+// no avr simulator here): every received byte costs BENCH_BYTE_CYCLES for
+// the rx interrupt, uart_getc and its share of the parser, and between two
+// SPI bytes the drawing loops do BENCH_GAP_CYCLES of work (next glyph bit or
+// pixel byte, loop and call overhead). With the pipelined _spi_write that
+// work overlaps the 16 cycle transfer, without it it follows it
+#define BENCH_BYTE_CYCLES 100
+#define BENCH_GAP_CYCLES 10
+// bytes demo.cpp takes from the uart per vt100_write, and its frame time
+#define BENCH_READ 32
+#define BENCH_FRAME_MS 40
+
+static uint32_t _baud;
+static uint16_t _rx_size;
+
+// bytes that arrive while demo.cpp does not read the uart: 3ms
+// (READ_GAP_BYTES)
+static uint32_t _uart_gap(void){
+	return _baud / 10 * 3 / 1000 + 1;
+}
+
+struct uart_model {
+	const uint8_t *data;
+	size_t len, sent; // bytes of the stream, and how many have arrived
+	uint8_t ring[4096];
+	uint16_t head, count, max_count;
+	uint32_t dropped;
+	double now, byte_time, spi_time; // in cpu cycles
+	uint32_t spi_mark;
+};
+
+// lets time pass up to cycle t, queueing (or dropping) what arrives
+static void _uart_until(struct uart_model *u, double t){
+	while(u->sent < u->len && (u->sent + 1) * u->byte_time <= t){
+		if(u->count < _rx_size){
+			u->ring[(u->head + u->count) % _rx_size] = u->data[u->sent];
+			if(++u->count > u->max_count) u->max_count = u->count;
+		} else {
+			u->dropped++;
+		}
+		u->sent++;
+	}
+	u->now = t;
+}
+
+// charges the SPI bytes sent since the last call and cpu work of n bytes
+static void _uart_spend(struct uart_model *u, size_t n){
+	uint32_t spi = sim_stats.spi_bytes - u->spi_mark;
+	u->spi_mark = sim_stats.spi_bytes;
+	_uart_until(u, u->now + spi * u->spi_time + n * (double)BENCH_BYTE_CYCLES);
+}
+
+static int _uart_flush(struct uart_model *u){
+	int more;
+#if VT100_INSTANCES > 1
+	if(_panes) more = vt100_flush_all(1);
+	else
+#endif
+	more = vt100_flush(1);
+	_uart_spend(u, 0);
+	return more;
+}
+
+// replays a stream arriving at _baud through the demo.cpp main loop and
+// prints the end-to-end rate (from the first byte on the wire until the
+// screen shows the end of the stream), the bytes lost to a full uart
+// buffer and the fullest the buffer got, with and without the pipeline
+static void _uart_run(const char *name, const uint8_t *data, size_t len){
+	uint16_t limit = _rx_size - _uart_gap();
+	printf("%-8s %9zu", name, len);
+	for(int pipelined = 1; pipelined >= 0; pipelined--){
+		static struct uart_model u;
+		memset(&u, 0, sizeof(u));
+		u.data = data;
+		u.len = len;
+		u.byte_time = 10.0 * F_CPU / _baud;
+		u.spi_time = pipelined?
+			(BENCH_GAP_CYCLES > SIM_CYCLES_PER_SPI_BYTE?BENCH_GAP_CYCLES:SIM_CYCLES_PER_SPI_BYTE):
+			SIM_CYCLES_PER_SPI_BYTE + BENCH_GAP_CYCLES;
+		_setup();
+		u.spi_mark = sim_stats.spi_bytes;
+		double frame = 0, frame_time = (double)F_CPU * BENCH_FRAME_MS / 1000;
+		uint8_t buf[BENCH_READ];
+		size_t n = 0;
+		while(1){
+			size_t got = n;
+			while(n < sizeof(buf) && u.count){
+				buf[n++] = u.ring[u.head];
+				u.head = (u.head + 1) % _rx_size;
+				u.count--;
+			}
+			got = n - got;
+			if(n){
+				// what the terminal does not take waits in buf for a flush step
+				size_t taken = n;
+#if VT100_INSTANCES > 1
+				if(_panes) _write(buf, n);
+				else
+#endif
+				taken = _take(0, buf, n);
+				_uart_spend(&u, taken);
+				memmove(buf, buf + taken, n - taken);
+				n -= taken;
+			}
+			if(n){
+				_uart_flush(&u);
+			} else if(u.now - frame >= frame_time){
+				while(_uart_flush(&u) && u.count < limit);
+				frame = u.now;
+			} else if(!u.count){
+				if(!_uart_flush(&u) && !got){
+					// idle until the next byte, or done
+					if(u.sent == u.len) break;
+					_uart_until(&u, (u.sent + 1) * u.byte_time);
+				}
+			}
+		}
+		printf(" %10.0f %8u %6u", len * (double)F_CPU / u.now, u.dropped, u.max_count);
+	}
+	printf("\n");
+}
+
+// hash of the character cells of the visible screen that only tells lit
+// pixels from black ones
+static uint32_t _text_hash(void){
+	uint32_t h = 2166136261u;
+	for(uint16_t y = 0; y < VT100_HEIGHT * VT100_CHAR_HEIGHT; y++)
+		for(uint16_t x = 0; x < VT100_WIDTH * VT100_CHAR_WIDTH; x++)
+			h = (h ^ (_pixel(x, y) != 0)) * 16777619u;
+	return h;
+}
+
+// A reference for the screen of a stream that does not go through vt100.c
+// or ili9340.c: a grid of characters with their palette colors that knows
+// just the sequences of the reference workloads (text without wrapping, CR,
+// LF, CUP, ICH, DCH, IL, DL, DECSTBM and the colors of SGR, with the
+// cursor left where it is by DECSTBM and a CUP past the screen leaving it
+// just outside, as vt100.c does), drawn from
+// font5x7.h as lit and black pixels the way _text_hash sees the screen.
+// The grid has the terminal's size, in either rotation
+#define REF_COLS VT100_WIDTH
+#define REF_ROWS VT100_HEIGHT
+#define REF_MAX (ILI9340_TFTHEIGHT / VT100_CHAR_WIDTH + 1)
+
+static struct {
+	uint8_t ch[REF_MAX][REF_MAX], fg[REF_MAX][REF_MAX], bg[REF_MAX][REF_MAX];
+	int x, y, top, bottom, fg_now, bg_now;
+} _ref;
+
+static void _ref_blank(int row){
+	memset(_ref.ch[row], ' ', REF_COLS);
+	memset(_ref.fg[row], _ref.fg_now, REF_COLS);
+	memset(_ref.bg[row], _ref.bg_now, REF_COLS);
+}
+
+// moves rows [from, bottom] of the scroll region up (n > 0) or down by n
+// rows, blanking the ones that open up
+static void _ref_shift(int from, int n){
+	for(int k = 0; k < abs(n); k++){
+		int r;
+		if(n > 0){
+			for(r = from; r < _ref.bottom; r++){
+				memcpy(_ref.ch[r], _ref.ch[r + 1], REF_COLS);
+				memcpy(_ref.fg[r], _ref.fg[r + 1], REF_COLS);
+				memcpy(_ref.bg[r], _ref.bg[r + 1], REF_COLS);
+			}
+		} else {
+			for(r = _ref.bottom; r > from; r--){
+				memcpy(_ref.ch[r], _ref.ch[r - 1], REF_COLS);
+				memcpy(_ref.fg[r], _ref.fg[r - 1], REF_COLS);
+				memcpy(_ref.bg[r], _ref.bg[r - 1], REF_COLS);
+			}
+		}
+		_ref_blank(r);
+	}
+}
+
+static void _ref_csi(char final, const int *arg, int narg){
+	int n = arg[0]?arg[0]:1;
+	uint8_t *ch = _ref.ch[_ref.y], *fg = _ref.fg[_ref.y], *bg = _ref.bg[_ref.y];
+	int tail = REF_COLS - _ref.x;
+	if(n > tail) n = tail;
+	switch(final){
+		case 'H':
+			_ref.y = (arg[0]?arg[0]:1) - 1;
+			_ref.x = (narg > 1 && arg[1]?arg[1]:1) - 1;
+			// as in vt100.c, past the last row or column leaves the cursor
+			// just outside the screen, where text is dropped
+			if(_ref.y > REF_ROWS) _ref.y = REF_ROWS;
+			if(_ref.x > REF_COLS) _ref.x = REF_COLS;
+			break;
+		case '@':
+			memmove(ch + _ref.x + n, ch + _ref.x, tail - n);
+			memmove(fg + _ref.x + n, fg + _ref.x, tail - n);
+			memmove(bg + _ref.x + n, bg + _ref.x, tail - n);
+			memset(ch + _ref.x, ' ', n);
+			memset(fg + _ref.x, _ref.fg_now, n);
+			memset(bg + _ref.x, _ref.bg_now, n);
+			break;
+		case 'P':
+			memmove(ch + _ref.x, ch + _ref.x + n, tail - n);
+			memmove(fg + _ref.x, fg + _ref.x + n, tail - n);
+			memmove(bg + _ref.x, bg + _ref.x + n, tail - n);
+			memset(ch + REF_COLS - n, ' ', n);
+			memset(fg + REF_COLS - n, _ref.fg_now, n);
+			memset(bg + REF_COLS - n, _ref.bg_now, n);
+			break;
+		case 'L':
+		case 'M':
+			n = arg[0]?arg[0]:1;
+			if(_ref.y < _ref.top || _ref.y > _ref.bottom) break;
+			if(n > _ref.bottom + 1 - _ref.y) n = _ref.bottom + 1 - _ref.y;
+			_ref_shift(_ref.y, (final == 'M')?n:-n);
+			_ref.x = 0;
+			break;
+		case 'r':
+			_ref.top = arg[0]?arg[0] - 1:0;
+			_ref.bottom = (narg > 1 && arg[1] && arg[1] < REF_ROWS)?arg[1] - 1:REF_ROWS - 1;
+			// the cursor stays where it is
+			if(_ref.top > _ref.bottom){
+				_ref.top = 0;
+				_ref.bottom = REF_ROWS - 1;
+			}
+			break;
+		case 'm':
+			for(int c = 0; c < (narg?narg:1); c++){
+				if(!arg[c]){
+					_ref.fg_now = 7;
+					_ref.bg_now = 0;
+				}
+				else if(arg[c] >= 30 && arg[c] < 38) _ref.fg_now = arg[c] - 30;
+				else if(arg[c] >= 40 && arg[c] < 48) _ref.bg_now = arg[c] - 40;
+			}
+			break;
+	}
+}
+
+static void _ref_feed(const uint8_t *data, size_t len){
+	memset(&_ref, 0, sizeof(_ref));
+	_ref.fg_now = 7;
+	_ref.bottom = REF_ROWS - 1;
+	for(int r = 0; r < REF_ROWS; r++) _ref_blank(r);
+	for(size_t c = 0; c < len; c++){
+		uint8_t b = data[c];
+		if(b == '\e' && c + 1 < len && data[c + 1] == '['){
+			int arg[8] = {0}, narg = 0;
+			for(c += 2; c < len && data[c] >= 0x30 && data[c] <= 0x3f; c++){
+				if(data[c] == ';'){
+					if(narg < 8) narg++;
+				}
+				else if(narg < 8) arg[narg] = arg[narg] * 10 + data[c] - '0';
+			}
+			if(c < len) _ref_csi(data[c], arg, narg + 1);
+		} else if(b == '\r'){
+			_ref.x = 0;
+		} else if(b == '\n'){
+			// on or below the bottom of the scroll region it scrolls the region,
+			// by one more row for each row the cursor is below it (vt100.c
+			// moves the cursor back into the region that way)
+			if(_ref.y >= _ref.bottom){
+				_ref_shift(_ref.top, _ref.y - _ref.bottom + 1);
+				_ref.y = _ref.bottom;
+			}
+			else _ref.y++;
+		} else if(b >= 0x20 && b < 0x7f && _ref.x < REF_COLS){
+			_ref.ch[_ref.y][_ref.x] = b;
+			_ref.fg[_ref.y][_ref.x] = _ref.fg_now;
+			_ref.bg[_ref.y][_ref.x] = _ref.bg_now;
+			_ref.x++;
+		}
+	}
+}
+
+static uint32_t _ref_hash(void){
+	uint32_t h = 2166136261u;
+	for(int y = 0; y < REF_ROWS * VT100_CHAR_HEIGHT; y++){
+		for(int x = 0; x < REF_COLS * VT100_CHAR_WIDTH; x++){
+			int row = y / VT100_CHAR_HEIGHT, col = x / VT100_CHAR_WIDTH;
+			int dx = x % VT100_CHAR_WIDTH, dy = y % VT100_CHAR_HEIGHT;
+			// palette index 0 is black, all others are lit
+			int glyph = dx < FONT5X7_WIDTH && (font5x7[_ref.ch[row][col] * FONT5X7_WIDTH + dx] >> dy & 1);
+			h = (h ^ ((glyph?_ref.fg[row][col]:_ref.bg[row][col]) != 0)) * 16777619u;
+		}
+	}
+	return h;
+}
+
+// replays the workloads that have a known screen bytewise and in chunks
+// flushed after every 1 and every 9 chunks, and compares the screen at the
+// end, or the hash over the screens after each of the first 1/n, 2/n, ...
+// of the stream. None of them may depend on when the flushes happen. In
+// rotations 2 and 3 and with panes the three runs only have to agree with
+// each other (and with the reference)
+static int _check(struct buffer *b){
+	static const struct { int bytewise, drain; const char *name; } feeds[] = {
+		{1, 1, "-b"}, {0, 1, "-d 1"}, {0, 9, "-d 9"}
+	};
+	int failed = 0;
+	for(size_t c = 0; c < sizeof(_workloads) / sizeof(_workloads[0]); c++){
+		const struct workload *w = &_workloads[c];
+		uint32_t expect = w->screen[0];
+		uint32_t (*hash)(void) = sim_screen_hash;
+		if(!expect) continue;
+#if defined(VT100_CELL_ATTRS) && !VT100_CELL_ATTRS
+		if(w->text[0]){
+			expect = w->text[0];
+			hash = _text_hash;
+		}
+#endif
+		int reference = w->reference && !_panes, differ = 0;
+#if defined(VT100_ROTATION) && VT100_ROTATION == 1
+		expect = (hash == _text_hash)?w->text[1]:w->screen[1];
+#elif defined(VT100_ROTATION) && VT100_ROTATION != 0
+		expect = 0;
+#endif
+		if(_panes) expect = 0;
+		b->len = 0;
+		_seed = 1;
+		w->generate(b);
+		for(size_t f = 0; f < sizeof(feeds) / sizeof(feeds[0]); f++){
+			_bytewise = feeds[f].bytewise;
+			_drain = feeds[f].drain;
+			uint32_t screen = 2166136261u;
+			for(int n = 1; n <= w->screens; n++){
+				size_t len = b->len * n / w->screens;
+				_feed(b->data, len);
+				screen = (w->screens > 1)?(screen ^ hash()) * 16777619u:hash();
+				if(reference){
+					_ref_feed(b->data, len);
+					if(_ref_hash() != _text_hash()) differ++;
+				}
+			}
+			if(!expect) expect = screen;
+			printf("%-8s %-4s %3d screens  %08x  %s\n", w->name, feeds[f].name, w->screens,
+				screen, (screen == expect)?"ok":"FAILED");
+			if(screen != expect) failed = 1;
+		}
+		if(reference){
+			printf("%-8s ref  %3d screens  %d differ  %s\n", w->name, w->screens * 3, differ,
+				differ?"FAILED":"ok");
+			if(differ) failed = 1;
+		}
+	}
+#if VT100_INSTANCES > 1
+	// closing the whole screen terminal puts its scrolled rows back where
+	// they show, which must leave the picture as it was
+	if(!_panes){
+		b->len = 0;
+		_seed = 1;
+		_gen_decstbm(b);
+		_bytewise = 0;
+		_drain = 1;
+		_feed(b->data, b->len);
+		uint32_t open = sim_screen_hash();
+		vt100_close(_term);
+		uint32_t closed = sim_screen_hash();
+		printf("%-8s %-4s %3d screens  %08x  %s\n", "close", "-d 1", 1, closed,
+			(closed == open)?"ok":"FAILED");
+		if(closed != open) failed = 1;
+	}
+#endif
+	return failed;
+}
+
+static int _read_file(const char *path, struct buffer *b){
+	FILE *f = fopen(path, "rb");
+	if(!f){ perror(path); return -1; }
+	char tmp[4096];
+	size_t n;
+	while((n = fread(tmp, 1, sizeof(tmp), f)) > 0) _buf_put(b, tmp, n);
+	fclose(f);
+	return 0;
+}
+
+static void _usage(const char *prog){
+	fprintf(stderr, "usage: %s [-b] [-p] [-c] [-d chunks] [-u baud [-r bytes]] [-w workload] [-o screen.ppm] [file...]\n", prog);
+	fprintf(stderr, "workloads:");
+	for(size_t c = 0; c < sizeof(_workloads) / sizeof(_workloads[0]); c++)
+		fprintf(stderr, " %s", _workloads[c].name);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv){
+	const char *only = NULL, *ppm = NULL;
+	int nfiles = 0, check = 0;
+	char **files = calloc(argc, sizeof(char*));
+
+	for(int c = 1; c < argc; c++){
+		if(!strcmp(argv[c], "-b")) _bytewise = 1;
+		else if(!strcmp(argv[c], "-p")) _panes = 1;
+		else if(!strcmp(argv[c], "-c")) check = 1;
+		else if(!strcmp(argv[c], "-d") && c + 1 < argc){
+			_drain = atoi(argv[++c]);
+			if(_drain < 1){ _usage(argv[0]); return 1; }
+		}
+		else if(!strcmp(argv[c], "-u") && c + 1 < argc){
+			_baud = atoi(argv[++c]);
+			if(_baud < 1200){ _usage(argv[0]); return 1; }
+		}
+		else if(!strcmp(argv[c], "-r") && c + 1 < argc){
+			_rx_size = atoi(argv[++c]);
+			if(_rx_size < 1 || _rx_size > sizeof(((struct uart_model*)0)->ring)){ _usage(argv[0]); return 1; }
+		}
+		else if(!strcmp(argv[c], "-w") && c + 1 < argc) only = argv[++c];
+		else if(!strcmp(argv[c], "-o") && c + 1 < argc) ppm = argv[++c];
+		else if(argv[c][0] == '-'){ _usage(argv[0]); return 1; }
+		else files[nfiles++] = argv[c];
+	}
+#if VT100_INSTANCES < 2
+	if(_panes){
+		fprintf(stderr, "%s: -p needs a build with -DVT100_INSTANCES=2\n", argv[0]);
+		return 1;
+	}
+#endif
+
+	if(_baud){
+		// the smallest power of two demo.cpp accepts for the baud rate
+		if(!_rx_size) for(_rx_size = 32; _rx_size < _uart_gap() * 2; _rx_size *= 2);
+		if(_uart_gap() * 2 > _rx_size || _rx_size > sizeof(((struct uart_model*)0)->ring)){
+			fprintf(stderr, "%s: a %u byte uart buffer is too small for %u baud (see README)\n",
+				argv[0], _rx_size, _baud);
+			return 1;
+		}
+		_bytewise = 0;
+	}
+
+	_boot();
+	struct buffer b = {0};
+	if(check){
+		int failed = _check(&b);
+		free(b.data);
+		free(files);
+		return failed;
+	}
+	if(_baud){
+		printf("uart: %u baud, %u byte buffer, backlog limit %u\n",
+			_baud, _rx_size, _rx_size - _uart_gap());
+		printf("%-8s %9s %10s %8s %6s %10s %8s %6s\n", "stream", "bytes",
+			"bytes/s", "dropped", "max_rx", "nopipe_B/s", "dropped", "max_rx");
+	} else {
+		printf("%-8s %9s %8s %7s %10s %10s %11s %7s %8s %8s %9s %10s %6s  %s\n",
+			"stream", "bytes", "glyphs", "elided", "bytes/s", "glyphs/s",
+			"spi_bytes", "spi/B", "windows", "cs", "spi_B/s", "lpm", "max_ms", "screen");
+	}
+
+	if(nfiles){
+		for(int c = 0; c < nfiles; c++){
+			b.len = 0;
+			if(_read_file(files[c], &b)) return 1;
+			const char *base = strrchr(files[c], '/');
+			(_baud?_uart_run:_run)(base?base + 1:files[c], b.data, b.len);
+		}
+	} else {
+		int found = 0;
+		for(size_t c = 0; c < sizeof(_workloads) / sizeof(_workloads[0]); c++){
+			if(only && strcmp(only, _workloads[c].name)) continue;
+			found = 1;
+			b.len = 0;
+			_seed = 1;
+			_workloads[c].generate(&b);
+			(_baud?_uart_run:_run)(_workloads[c].name, b.data, b.len);
+		}
+		if(!found){ _usage(argv[0]); return 1; }
+	}
+
+	if(ppm){
+		FILE *f = fopen(ppm, "wb");
+		if(!f || sim_dump_ppm(f)){ perror(ppm); return 1; }
+		fclose(f);
+	}
+	free(b.data);
+	free(files);
+	return 0;
+}
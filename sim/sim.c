@@ -0,0 +1,271 @@
+/**
+	This file is part of FORTMAX.
+
+	FORTMAX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	FORTMAX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with FORTMAX.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright: Martin K. Schröder (info@fortmax.se) 2014
+*/
+
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "sim.h"
+#include "ili9340.h"
+
+// control lines as wired in ili9340.c
+#define SIM_DC_PIN PB0
+#define SIM_CS_PIN PB2
+
+volatile uint8_t sim_reg_ddrb, sim_reg_ddrd, sim_reg_portd;
+volatile uint8_t sim_reg_spcr;
+
+struct sim_stats sim_stats;
+
+static struct sim_panel {
+	// registers that need to see accesses
+	volatile uint8_t portb, spdr, spsr;
+	uint8_t spdr_pending;
+	uint8_t last_portb;
+	// a byte is on the wire from the SPDR write until SPSR is polled
+	uint8_t in_flight;
+	uint8_t port_touched_in_flight;
+	// controller state
+	uint8_t cmd;
+	uint8_t nparam;
+	uint8_t params[6];
+	uint8_t madctl;
+	uint16_t xs, xe, ys, ye;
+	uint16_t x, y;
+	uint8_t pixel_hi;
+	// vertical scrolling definition and start address
+	uint16_t tfa, vsa, bfa;
+	uint16_t vsp;
+	uint16_t gram[SIM_GRAM_HEIGHT][SIM_GRAM_WIDTH];
+} panel;
+
+static void _sim_watch_port(void){
+	uint8_t now = panel.portb;
+	uint8_t cs_mask = _BV(SIM_CS_PIN);
+	if((panel.last_portb & cs_mask) && !(now & cs_mask))
+		sim_stats.cs_toggles++;
+	// CS or DC changed while a byte was still being shifted out
+	if(panel.port_touched_in_flight &&
+		((panel.last_portb ^ now) & (cs_mask | _BV(SIM_DC_PIN))))
+		sim_stats.spi_violations++;
+	panel.port_touched_in_flight = 0;
+	panel.last_portb = now;
+}
+
+// stores a pixel at logical (column, page) address honoring MADCTL
+static void _sim_store(uint16_t col, uint16_t page, uint16_t color){
+	uint16_t nx = col, ny = page;
+	if(panel.madctl & ILI9340_MADCTL_MV){
+		nx = page;
+		ny = col;
+	}
+	if(panel.madctl & ILI9340_MADCTL_MX) nx = SIM_GRAM_WIDTH - 1 - nx;
+	if(panel.madctl & ILI9340_MADCTL_MY) ny = SIM_GRAM_HEIGHT - 1 - ny;
+	if(nx >= SIM_GRAM_WIDTH || ny >= SIM_GRAM_HEIGHT) return;
+	panel.gram[ny][nx] = color;
+}
+
+static void _sim_command(uint8_t c){
+	sim_stats.cmd_bytes++;
+	panel.cmd = c;
+	panel.nparam = 0;
+	if(c == ILI9340_RAMWR){
+		panel.x = panel.xs;
+		panel.y = panel.ys;
+		sim_stats.windows++;
+	}
+	// RAMWRC goes on from the pixel after the last one written
+}
+
+static void _sim_data(uint8_t d){
+	uint8_t *p = panel.params;
+	switch(panel.cmd){
+		case ILI9340_CASET:
+		case ILI9340_PASET:
+		case 0x33: // VSCRDEF
+		case 0x37: // VSCRSADD
+		case ILI9340_MADCTL:
+			if(panel.nparam < sizeof(panel.params))
+				p[panel.nparam++] = d;
+			break;
+		case ILI9340_RAMWR:
+		case ILI9340_RAMWRC:
+			if(!(panel.nparam++ & 1)){
+				panel.pixel_hi = d;
+				return;
+			}
+			_sim_store(panel.x, panel.y, (panel.pixel_hi << 8) | d);
+			sim_stats.pixels++;
+			if(++panel.x > panel.xe){
+				panel.x = panel.xs;
+				if(++panel.y > panel.ye) panel.y = panel.ys;
+			}
+			return;
+		default:
+			return;
+	}
+	switch(panel.cmd){
+		case ILI9340_CASET:
+			if(panel.nparam == 2) panel.xs = (p[0] << 8) | p[1];
+			if(panel.nparam == 4) panel.xe = (p[2] << 8) | p[3];
+			break;
+		case ILI9340_PASET:
+			if(panel.nparam == 2) panel.ys = (p[0] << 8) | p[1];
+			if(panel.nparam == 4) panel.ye = (p[2] << 8) | p[3];
+			break;
+		case 0x33:
+			if(panel.nparam == 6){
+				panel.tfa = (p[0] << 8) | p[1];
+				panel.vsa = (p[2] << 8) | p[3];
+				panel.bfa = (p[4] << 8) | p[5];
+			}
+			break;
+		case 0x37:
+			if(panel.nparam == 2) panel.vsp = (p[0] << 8) | p[1];
+			break;
+		case ILI9340_MADCTL:
+			panel.madctl = p[0];
+			break;
+	}
+}
+
+// shifts out the byte that was last written to SPDR
+static void _sim_commit(void){
+	if(!panel.spdr_pending) return;
+	panel.spdr_pending = 0;
+	sim_stats.spi_bytes++;
+	if(panel.portb & _BV(SIM_CS_PIN)) return; // panel not selected
+	if(panel.portb & _BV(SIM_DC_PIN))
+		_sim_data(panel.spdr);
+	else
+		_sim_command(panel.spdr);
+}
+
+volatile uint8_t *sim_portb(void){
+	_sim_commit();
+	_sim_watch_port();
+	sim_stats.port_writes++;
+	panel.port_touched_in_flight = panel.in_flight;
+	return &panel.portb;
+}
+
+volatile uint8_t *sim_spdr(void){
+	_sim_commit();
+	_sim_watch_port();
+	// writing SPDR before the previous transfer completed (WCOL)
+	if(panel.in_flight) sim_stats.spi_violations++;
+	panel.in_flight = 1;
+	panel.spdr_pending = 1;
+	return &panel.spdr;
+}
+
+volatile uint8_t *sim_spsr(void){
+	_sim_commit();
+	_sim_watch_port();
+	// the transfer finishes instantly on the host
+	panel.in_flight = 0;
+	panel.spsr |= _BV(SPIF);
+	return &panel.spsr;
+}
+
+uint8_t sim_pgm_read_byte(const void *addr){
+	sim_stats.flash_reads++;
+	return *(const uint8_t *)addr;
+}
+
+uint16_t sim_pgm_read_word(const void *addr){
+	sim_stats.flash_reads += 2;
+	return *(const uint16_t *)addr;
+}
+
+// a pointer is two bytes on avr
+const void *sim_pgm_read_ptr(const void *addr){
+	sim_stats.flash_reads += 2;
+	return *(const void * const *)addr;
+}
+
+void sim_delay_us(double us){
+	_sim_commit();
+	_sim_watch_port();
+	panel.in_flight = 0;
+	sim_stats.delay_us += us;
+}
+
+void sim_clear_stats(void){
+	_sim_commit();
+	memset(&sim_stats, 0, sizeof(sim_stats));
+}
+
+void sim_reset(void){
+	memset(&panel, 0, sizeof(panel));
+	panel.portb = panel.last_portb = _BV(SIM_CS_PIN);
+	panel.xe = SIM_GRAM_WIDTH - 1;
+	panel.ye = SIM_GRAM_HEIGHT - 1;
+	panel.vsa = SIM_GRAM_HEIGHT;
+	memset(&sim_stats, 0, sizeof(sim_stats));
+}
+
+uint16_t sim_gram_pixel(uint16_t x, uint16_t y){
+	_sim_commit();
+	if(x >= SIM_GRAM_WIDTH || y >= SIM_GRAM_HEIGHT) return 0;
+	return panel.gram[y][x];
+}
+
+uint16_t sim_screen_pixel(uint16_t x, uint16_t y){
+	// the glass is mounted so that MX gives an upright picture in rotation 0
+	uint16_t nx = SIM_GRAM_WIDTH - 1 - x;
+	uint16_t ny = y;
+	uint16_t top = panel.tfa, bottom = panel.tfa + panel.vsa;
+	if(bottom <= SIM_GRAM_HEIGHT && panel.vsa && y >= top && y < bottom){
+		// first line of the scroll area shows the line at VSP
+		uint16_t start = (panel.vsp >= top && panel.vsp < bottom)?panel.vsp:top;
+		ny = start + (y - top);
+		if(ny >= bottom) ny -= panel.vsa;
+	}
+	return sim_gram_pixel(nx, ny);
+}
+
+uint32_t sim_screen_hash(void){
+	uint32_t h = 2166136261u;
+	for(uint16_t y = 0; y < SIM_GRAM_HEIGHT; y++){
+		for(uint16_t x = 0; x < SIM_GRAM_WIDTH; x++){
+			uint16_t p = sim_screen_pixel(x, y);
+			h = (h ^ (p & 0xff)) * 16777619u;
+			h = (h ^ (p >> 8)) * 16777619u;
+		}
+	}
+	return h;
+}
+
+int sim_dump_ppm(FILE *out){
+	fprintf(out, "P6\n%d %d\n255\n", SIM_GRAM_WIDTH, SIM_GRAM_HEIGHT);
+	for(uint16_t y = 0; y < SIM_GRAM_HEIGHT; y++){
+		for(uint16_t x = 0; x < SIM_GRAM_WIDTH; x++){
+			uint16_t p = sim_screen_pixel(x, y);
+			uint8_t rgb[3] = {
+				(uint8_t)((p >> 11) << 3),
+				(uint8_t)(((p >> 5) & 0x3f) << 2),
+				(uint8_t)((p & 0x1f) << 3)
+			};
+			if(fwrite(rgb, 1, 3, out) != 3) return -1;
+		}
+	}
+	return 0;
+}
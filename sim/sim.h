@@ -0,0 +1,76 @@
+/**
+	This file is part of FORTMAX.
+
+	FORTMAX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	FORTMAX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with FORTMAX.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright: Martin K. Schröder (info@fortmax.se) 2014
+*/
+
+/**
+	Simulated ILI9340 panel for host builds.
+
+	ili9340.c is compiled unchanged against the register stand-ins in
+	sim/avr/io.h. Every byte written to SPDR is decoded here the same way the
+	controller would (CASET, PASET, RAMWR, RAMWRC, MADCTL, VSCRDEF, VSCRSADD)
+	into a 240x320 RGB565 GRAM array, and counted so that the benchmark can
+	report how much SPI traffic a byte stream costs on real hardware.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_GRAM_WIDTH 240
+#define SIM_GRAM_HEIGHT 320
+
+// with SPI2X and SPR = 0 the SPI clock is F_CPU/2, so a byte takes 16 cycles
+#define SIM_CYCLES_PER_SPI_BYTE 16
+
+struct sim_stats {
+	uint32_t spi_bytes; // every byte written to SPDR
+	uint32_t cmd_bytes; // bytes sent with DC low
+	uint32_t pixels; // pixels stored into GRAM through RAMWR
+	uint32_t windows; // number of RAMWR commands (one per address window)
+	uint32_t cs_toggles; // CS high->low transitions
+	uint32_t port_writes; // writes to the control port (CS/DC/RST)
+	// SPDR written or CS/DC changed before the previous byte finished
+	// shifting out (assuming the cpu is always faster than the SPI clock)
+	uint32_t spi_violations;
+	uint32_t flash_reads; // bytes read with pgm_read_byte/word (lpm)
+	double delay_us; // time spent in _delay_ms/_delay_us
+};
+
+extern struct sim_stats sim_stats;
+
+// clears GRAM, controller state and the statistics
+void sim_reset(void);
+void sim_clear_stats(void);
+
+// raw GRAM pixel in controller memory order
+uint16_t sim_gram_pixel(uint16_t x, uint16_t y);
+// pixel as seen on the glass, i.e. after vertical scrolling is applied
+uint16_t sim_screen_pixel(uint16_t x, uint16_t y);
+// 32 bit FNV hash of the visible screen, for comparing renderer changes
+uint32_t sim_screen_hash(void);
+// writes the visible screen as a binary ppm image
+int sim_dump_ppm(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,11 @@
+/**
+	Host stand-in for <util/delay.h>. Delays do not block, they are added to
+	the simulated time kept by sim.c so that boot latency can be reported.
+*/
+
+#pragma once
+
+void sim_delay_us(double us);
+
+#define _delay_us(us) sim_delay_us(us)
+#define _delay_ms(ms) sim_delay_us((ms) * 1000.0)
@@ -0,0 +1,83 @@
+/**
+	This file is part of FORTMAX.
+
+	FORTMAX is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	FORTMAX is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with FORTMAX.  If not, see <http://www.gnu.org/licenses/>.
+
+	Copyright: Martin K. Schröder (info@fortmax.se) 2014
+*/
+
+/**
+	Build time font converter.
+
+	Reads the column-major glyphs in font5x7.h and writes font_rows.h, a
+	PROGMEM table of row-major bitmaps: one byte per glyph scanline with the
+	leftmost column in bit 7, the 5 glyph columns in bits 7..3 and the
+	separator column in bit 2. The drawing kernels shift the byte left once
+	per pixel, so a scanline of a glyph is a single flash read instead of one
+	read and one mask test per column.
+
+	The table is laid out as font_rows[scanline][ch] so that the address of
+	a glyph scanline is a base plus the character code, without a multiply.
+	All 256 codes are present; codes past the end of font5x7 are blank.
+
+	usage: fontconv [output.h]  (writes to stdout without an argument)
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PROGMEM
+#include "../font5x7.h"
+
+#define FONT_ROWS 8
+#define FONT_CODES 256
+
+static uint8_t _row_bits(unsigned ch, unsigned row){
+	uint8_t bits = 0;
+	if(ch >= FONT5X7_GLYPHS) return 0;
+	for(unsigned col = 0; col < FONT5X7_WIDTH; col++){
+		if(font5x7[ch * FONT5X7_WIDTH + col] & (1 << row))
+			bits |= 0x80 >> col;
+	}
+	// column FONT5X7_WIDTH (bit 2) is the separator and stays clear
+	return bits;
+}
+
+int main(int argc, char **argv){
+	FILE *out = stdout;
+	if(argc > 1 && !(out = fopen(argv[1], "w"))){
+		perror(argv[1]);
+		return 1;
+	}
+
+	fprintf(out, "// generated by tools/fontconv.c from font5x7.h, do not edit\n\n");
+	fprintf(out, "#pragma once\n\n");
+	fprintf(out, "static const unsigned char font_rows[%d][%d] PROGMEM = {\n",
+		FONT_ROWS, FONT_CODES);
+	for(unsigned row = 0; row < FONT_ROWS; row++){
+		fprintf(out, "{\n");
+		for(unsigned ch = 0; ch < FONT_CODES; ch++){
+			fprintf(out, "0x%02X,%s", _row_bits(ch, row),
+				((ch & 15) == 15)?"\n":" ");
+		}
+		fprintf(out, "},\n");
+	}
+	fprintf(out, "};\n");
+
+	if(out != stdout && fclose(out)){
+		perror(argv[1]);
+		return 1;
+	}
+	return 0;
+}
@@ -18,8 +18,10 @@
 */
 
 #include <avr/io.h>
-#include <ctype.h>
+#include <avr/pgmspace.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "vt100.h"
 #include "ili9340.h"
@@ -28,22 +30,149 @@
 #define KEY_DEL 0x7f
 #define KEY_BELL 0x07
 
-#define STATE(NAME, TERM, EV, ARG) void NAME(struct vt100 *TERM, uint8_t EV, uint16_t ARG)
-
-// states 
+// parser states, after the DEC ANSI parser (vt100.net/emu/dec_ansi_parser).
+// Device control strings and operating system commands (and SOS, PM and APC,
+// which are parsed like OSC) are not supported and skipped up to their end
 enum {
-	STATE_IDLE,
-	STATE_ESCAPE,
-	STATE_COMMAND
-};
-
-// events that are passed into states
-enum {
-	EV_CHAR = 1,
+	ST_GROUND,
+	ST_ESCAPE,
+	ST_ESC_INTER,
+	ST_CSI_ENTRY,
+	ST_CSI_PARAM,
+	ST_CSI_INTER,
+	ST_CSI_IGNORE,
+	ST_DCS,
+	ST_OSC
 };
 
+// parameters of a control sequence after the first MAX_COMMAND_ARGS are
+// parsed but dropped. The 2 KB parts keep 4, which covers every sequence
+// with a fixed number of parameters and SGR with up to 4 attributes
+#ifndef MAX_COMMAND_ARGS
+#if defined(RAMEND) && RAMEND < 0x1000
 #define MAX_COMMAND_ARGS 4
-static struct vt100 {
+#else
+#define MAX_COMMAND_ARGS 8
+#endif
+#endif
+
+#define VT100_ROW_CLEAR 0x80
+
+// characters drawn per ili9340_drawChars call while redrawing a row. They
+// are copied out of the cell grid into a buffer on the stack, which the
+// 2 KB parts keep short (a longer run takes one more column address)
+#ifndef VT100_DRAW_CHARS
+#if defined(RAMEND) && RAMEND < 0x1000
+#define VT100_DRAW_CHARS 16
+#else
+#define VT100_DRAW_CHARS VT100_MAX_COLS
+#endif
+#endif
+
+// vt100_flush draws a row in steps of at most this many columns of pixels
+// (cleared or drawn), so that the main loop gets to empty the uart buffer
+// at least every 20 * 48 pixels, about 2 ms of SPI time
+#ifndef VT100_FLUSH_COLS
+#define VT100_FLUSH_COLS 20
+#endif
+#define VT100_NO_ROW 0xff
+
+// The terminal keeps a shadow copy of the screen so that editing commands
+// (insert/delete characters and lines) can redraw shifted text without
+// reading back the display. There is a cell for every character position of
+// the panel in either orientation (40x40 in portrait, 53x30 in landscape),
+// or exactly the ones of the rotation fixed with VT100_ROTATION.
+#ifdef VT100_ROTATION
+#define VT100_MAX_COLS VT100_WIDTH
+#define VT100_MAX_ROWS VT100_HEIGHT
+#define VT100_MAX_CELLS (VT100_WIDTH * VT100_HEIGHT)
+#else
+#define VT100_MAX_COLS (ILI9340_TFTHEIGHT / VT100_CHAR_WIDTH)
+#define VT100_MAX_ROWS (ILI9340_TFTHEIGHT / VT100_CHAR_HEIGHT)
+#define VT100_MAX_CELLS ((ILI9340_TFTWIDTH / VT100_CHAR_WIDTH) * VT100_MAX_ROWS)
+#endif
+
+// Position and size of a terminal on the display. With more than one
+// terminal every one has its own viewport, otherwise the terminal covers the
+// whole display and all of this is constant (or the size is worked out once
+// by _vt100_reset in the runtime geometry build)
+#if VT100_INSTANCES > 1
+#define VT100_COLS(t) ((t)->cols)
+#define VT100_ROWS(t) ((t)->rows)
+#define VT100_LEFT(t) ((t)->left)
+#define VT100_TOP(t) ((t)->top)
+#define VT100_VIEW_WIDTH(t) ((t)->view_width)
+#define VT100_FULLSCREEN(t) ((t)->flags.fullscreen)
+#else
+#ifndef VT100_ROTATION
+static uint8_t _vt100_width, _vt100_height;
+#undef VT100_WIDTH
+#undef VT100_HEIGHT
+#define VT100_WIDTH _vt100_width
+#define VT100_HEIGHT _vt100_height
+#endif
+#define VT100_COLS(t) VT100_WIDTH
+#define VT100_ROWS(t) VT100_HEIGHT
+#define VT100_LEFT(t) 0
+#define VT100_TOP(t) 0
+#define VT100_VIEW_WIDTH(t) VT100_SCREEN_WIDTH
+#define VT100_FULLSCREEN(t) 1
+#endif
+
+// The display scrolls in hardware along its 320 pixel side, which is only
+// the vertical one in portrait. In landscape the terminal that covers the
+// display moves its lines in the cell grid to scroll, as a pane does
+#ifdef VT100_ROTATION
+#define VT100_PORTRAIT (!(VT100_ROTATION & 1))
+#else
+#define VT100_PORTRAIT (VT100_SCREEN_HEIGHT == ILI9340_TFTHEIGHT)
+#endif
+#define VT100_HW_SCROLL(t) (VT100_FULLSCREEN(t) && VT100_PORTRAIT)
+
+// pixel position of column col and display ram row phys of terminal t
+#define VT100_PIXEL_X(t, col) (VT100_LEFT(t) + (col) * VT100_CHAR_WIDTH)
+#define VT100_PIXEL_Y(t, phys) (VT100_TOP(t) + (phys) * VT100_CHAR_HEIGHT)
+
+// character attributes: fg palette index in bits 0-2 and bg index in bits 3-5
+#define VT100_DEFAULT_ATTR 0x07
+#define VT100_ATTR_FG(attr) ((attr) & 0x07)
+#define VT100_ATTR_BG(attr) (((attr) >> 3) & 0x07)
+
+// With VT100_CELL_ATTRS a cell is 16 bits: the character in the low byte and
+// its attribute in the high byte. That does not fit next to the uart buffers
+// in the 2 KB of an atmega328p, so there cells are a single byte holding the
+// 7 bit character and a flag for text that is not in the default colors. A
+// row keeps two attributes for its flagged cells, one for those left of a
+// split column and one for the rest, which is exact for up to two colored
+// runs of text in a row (a prompt, a status line). Past that the row is
+// mixed: its flagged cells take the last attribute used on it when they are
+// redrawn, and _vt100_mustDraw holds back the input until what is pending on
+// the row has been drawn in the colors it was written with.
+#ifndef VT100_CELL_ATTRS
+#if defined(RAMEND) && RAMEND < 0x1000
+#define VT100_CELL_ATTRS 0
+#else
+#define VT100_CELL_ATTRS 1
+#endif
+#endif
+
+#if VT100_CELL_ATTRS
+typedef uint16_t vt100_cell_t;
+#define VT100_CELL_CHAR(cell) ((uint8_t)(cell))
+#define VT100_BLANK_CELL ((vt100_cell_t)(' ' | (VT100_DEFAULT_ATTR << 8)))
+#else
+typedef uint8_t vt100_cell_t;
+#define VT100_CELL_COLORED 0x80
+#define VT100_CELL_CHAR(cell) ((cell) & 0x7f)
+#define VT100_BLANK_CELL ((vt100_cell_t)' ')
+// row_attr values: a row without colored cells, and a flag for rows whose
+// colored cells have more attributes than a row keeps (so the display does
+// not necessarily show them in the row attribute)
+#define VT100_ROW_PLAIN 0xff
+#define VT100_ROW_MIXED 0x40
+#endif
+
+struct vt100 {
 	union flags {
 		uint8_t val;
 		struct {
@@ -52,87 +181,182 @@ static struct vt100 {
 			uint8_t cursor_wrap : 1; 
 			uint8_t scroll_mode : 1;
 			uint8_t origin_mode : 1; 
+			// the terminal has the display to itself: it scrolls with the
+			// display's scroll area, and text past its right or bottom edge
+			// is drawn off screen. A terminal in a smaller viewport (a pane)
+			// scrolls by redrawing and draws nothing outside of it
+			uint8_t fullscreen : 1;
+			// in use, vt100_open does not hand it out again
+			uint8_t open : 1;
+			// the input stopped at a byte that has to wait until a row is
+			// drawn (see _vt100_mustDraw)
+			uint8_t wait : 1;
 		}; 
 	} flags;
+#if VT100_INSTANCES > 1
+	// viewport on the display: top left corner and width in pixels, and the
+	// size in characters
+	uint16_t left, top, view_width;
+	uint8_t cols, rows;
+#endif
 	
 	//uint16_t screen_width, screen_height;
 	// cursor position on the screen (0, 0) = top left corner. 
 	int16_t cursor_x, cursor_y;
+	// display ram row of the cursor line, kept up to date whenever the cursor
+	// moves or the screen scrolls (see _vt100_trackRow)
+	uint8_t cursor_phys;
 	int16_t saved_cursor_x, saved_cursor_y; // used for cursor save restore
 	int16_t scroll_start_row, scroll_end_row; 
-	// character width and height
-	int8_t char_width, char_height;
 	// colors used for rendering current characters
 	uint16_t back_color, front_color;
+	// the same colors as palette indices (see VT100_DEFAULT_ATTR)
+	uint8_t attr;
 	// the starting y-position of the screen scroll
 	uint16_t scroll_value; 
-	// command arguments that get parsed as they appear in the terminal
+	// parser state (ST_*) and the intermediate or private marker byte of the
+	// sequence being parsed, 0xff when it had more than one
+	uint8_t state, inter;
+	// command arguments that get parsed as they appear in the terminal, 0
+	// where not given. narg counts up to MAX_COMMAND_ARGS + 1
 	uint8_t narg; uint16_t args[MAX_COMMAND_ARGS];
-	// current arg pointer (we use it for parsing) 
-	uint8_t carg;
-	
-	void (*state)(struct vt100 *term, uint8_t ev, uint16_t arg);
+
 	void (*send_response)(char *str);
-	void (*ret_state)(struct vt100 *term, uint8_t ev, uint16_t arg); 
-} term;
-
-STATE(_st_idle, term, ev, arg);
-STATE(_st_esc_sq_bracket, term, ev, arg);
-STATE(_st_esc_question, term, ev, arg);
-STATE(_st_esc_hash, term, ev, arg);
-
-void _vt100_reset(void){
-	//term.screen_width = VT100_SCREEN_WIDTH;
-  //term.screen_height = VT100_SCREEN_HEIGHT;
-  term.char_height = 8;
-  term.char_width = 6;
-  term.back_color = 0x0000;
-  term.front_color = 0xffff;
-  term.cursor_x = term.cursor_y = term.saved_cursor_x = term.saved_cursor_y = 0;
-  term.narg = 0;
-  term.state = _st_idle;
-  term.ret_state = 0;
-  term.scroll_value = 0; 
-  term.scroll_start_row = 0;
-  term.scroll_end_row = VT100_HEIGHT; // outside of screen = whole screen scrollable
-  term.flags.cursor_wrap = 0;
-  term.flags.origin_mode = 0; 
-  ili9340_setFrontColor(term.front_color);
-	ili9340_setBackColor(term.back_color);
-	ili9340_setScrollMargins(0, 0); 
-	ili9340_setScrollStart(0); 
-}
-
-void _vt100_resetScroll(void){
-	term.scroll_start_row = 0;
-	term.scroll_end_row = VT100_HEIGHT;
-	term.scroll_value = 0; 
-	ili9340_setScrollMargins(0, 0);
-	ili9340_setScrollStart(0); 
-}
-
-#define VT100_CURSOR_X(TERM) (TERM->cursor_x * TERM->char_width)
-
-inline uint16_t VT100_CURSOR_Y(struct vt100 *t){
+
+	// shadow copy of the screen, indexed by display ram row (see _vt100_physRow)
+	vt100_cell_t cells[VT100_MAX_CELLS];
+#if !VT100_CELL_ATTRS
+	// attribute of the colored cells on each display ram row (VT100_ROW_*),
+	// except for the ones left of column row_split, which have row_left
+	uint8_t row_attr[VT100_MAX_ROWS], row_left[VT100_MAX_ROWS], row_split[VT100_MAX_ROWS];
+	// display ram row the input waits for (flags.wait), drawn first
+	uint8_t wait_row;
+#endif
+	// columns [dirty_lo, dirty_hi) of each display ram row may differ between
+	// the cell grid and the display until the next vt100_flush. VT100_ROW_CLEAR
+	// in dirty_hi means that the rest of the row still has to be cleared
+	uint8_t dirty_lo[VT100_MAX_ROWS], dirty_hi[VT100_MAX_ROWS];
+	uint8_t dirty_rows;
+	// rows that have been erased: their cells are not filled in until the
+	// row is written to again
+	uint8_t blank[(VT100_MAX_ROWS + 7) / 8];
+	// the scroll start on the display is out of date
+	uint8_t scroll_pending;
+	// a flush step stopped while clearing display ram row clear_row: the
+	// columns below clear_col outside of the dirty span are already cleared,
+	// or (clear_col = 0) the top clear_line pixel lines of an erased row
+	uint8_t clear_row, clear_col, clear_line;
+};
+
+// the first one is the default terminal of vt100_init, vt100_write and the
+// other functions without a terminal argument
+static struct vt100 _vt100_terms[VT100_INSTANCES];
+// terminal that gets the next step of vt100_flush_all
+static uint8_t _vt100_turn;
+
+#if VT100_STATS
+struct vt100_stats vt100_stats;
+#define VT100_STAT(expr) do { vt100_stats.expr; } while(0)
+#else
+#define VT100_STAT(expr) do {} while(0)
+#endif
+
+// ansi color palette, indexed by the attribute fg/bg fields
+static const uint16_t _vt100_colors[] PROGMEM = {
+	0x0000, // black
+	0xf800, // red
+	0x0780, // green
+	0xfe00, // yellow
+	0x001f, // blue
+	0xf81f, // magenta
+	0x07ff, // cyan
+	0xffff // white
+};
+
+
+void _vt100_clearLines(struct vt100 *t, uint16_t start_line, uint16_t end_line);
+static void _vt100_copyLine(struct vt100 *t, uint16_t dst, uint16_t src);
+static void _vt100_unscroll(struct vt100 *t);
+
+void _vt100_reset(struct vt100 *t){
+	//t->screen_width = VT100_SCREEN_WIDTH;
+  //t->screen_height = VT100_SCREEN_HEIGHT;
+#if VT100_INSTANCES == 1 && !defined(VT100_ROTATION)
+  _vt100_width = VT100_SCREEN_WIDTH / VT100_CHAR_WIDTH;
+  _vt100_height = VT100_SCREEN_HEIGHT / VT100_CHAR_HEIGHT;
+#endif
+  t->back_color = 0x0000;
+  t->front_color = 0xffff;
+  t->attr = VT100_DEFAULT_ATTR;
+  t->cursor_x = t->cursor_y = t->saved_cursor_x = t->saved_cursor_y = 0;
+  t->cursor_phys = 0;
+  t->narg = 0;
+  t->state = ST_GROUND;
+  t->scroll_value = 0; 
+  t->scroll_start_row = 0;
+  t->scroll_end_row = VT100_ROWS(t); // outside of screen = whole screen scrollable
+  t->flags.cursor_wrap = 0;
+  t->flags.origin_mode = 0; 
+  memset(t->dirty_hi, 0, sizeof(t->dirty_hi));
+  t->dirty_rows = 0;
+  t->scroll_pending = 0;
+  t->clear_row = VT100_NO_ROW;
+  ili9340_setFrontColor(t->front_color);
+	ili9340_setBackColor(t->back_color);
+	// the display's scroll area belongs to the terminal that covers it all,
+	// a pane leaves it alone (it is unscrolled while panes are open)
+	if(VT100_FULLSCREEN(t)){
+		ili9340_setScrollMargins(0, 0); 
+		ili9340_setScrollStart(0); 
+	}
+	// start from a blank screen, the display is cleared by the next flush
+	_vt100_clearLines(t, 0, VT100_ROWS(t) - 1);
+}
+
+void _vt100_resetScroll(struct vt100 *t){
+	_vt100_unscroll(t);
+	t->scroll_start_row = 0;
+	t->scroll_end_row = VT100_ROWS(t);
+	t->scroll_value = 0; 
+	t->scroll_pending = 0;
+	// without scrolling every row is shown where it is in display ram
+	t->cursor_phys = t->cursor_y;
+	if(VT100_FULLSCREEN(t)){
+		ili9340_setScrollMargins(0, 0);
+		ili9340_setScrollStart(0); 
+	}
+}
+
+#define VT100_CURSOR_X(TERM) VT100_PIXEL_X(TERM, TERM->cursor_x)
+
+// maps a screen row to the row of display ram (and of the cell grid) that is
+// currently showing it
+static inline uint16_t _vt100_physRow(struct vt100 *t, int16_t row){
 	// if within the top or bottom margin areas then normal addressing
-	if(t->cursor_y < t->scroll_start_row || t->cursor_y >= t->scroll_end_row){
-		return t->cursor_y * VT100_CHAR_HEIGHT; 
+	if(row < t->scroll_start_row || row >= t->scroll_end_row){
+		return row; 
 	} else {
 		// otherwise we are inside scroll area
+		// scroll_value is kept below the height of the scroll region (see
+		// _vt100_unscroll), so this runs at most once
 		uint16_t scroll_height = t->scroll_end_row - t->scroll_start_row;
-		uint16_t row = t->cursor_y + t->scroll_value; 
-		if(t->cursor_y + t->scroll_value >= t->scroll_end_row)
-			row -= scroll_height; 
-		// if scroll_value == 0: y = t->cursor_y;
-		// if scroll_value == 1 && scroll_start_row == 2 && scroll_end_row == 38:
-		// 		y = t->cursor_y + scroll_value; 
-		//uint16_t row = (t->cursor_y - t->scroll_start_row) % scroll_height; 
-		/*uint16_t skip = t->scroll_value - t->scroll_start_row; 
-		uint16_t row = t->cursor_y + skip;
-		uint16_t scroll_height = t->scroll_end_row - t->scroll_start_row; 
-		//row = (row % scroll_height);// + t->scroll_start_row;*/
-		return row * VT100_CHAR_HEIGHT; 
+		uint16_t phys = row + t->scroll_value; 
+		while(phys >= t->scroll_end_row)
+			phys -= scroll_height; 
+		return phys; 
 	}
+}
+
+// updates the display ram row of the cursor after the cursor row, the scroll
+// region or the scroll value changed. Like _vt100_physRow this is one compare
+// and subtract, no division
+static inline void _vt100_trackRow(struct vt100 *t){
+	t->cursor_phys = _vt100_physRow(t, t->cursor_y);
+}
+
+static inline uint16_t VT100_CURSOR_Y(struct vt100 *t){
+	return VT100_PIXEL_Y(t, t->cursor_phys); 
+
 	/*uint16_t y = 0;
 	if(t->cursor_y >= t->top_margin && t->cursor_y < t->bottom_margin){
 		y = t->cursor_y * VT100_CHAR_HEIGHT;
@@ -152,42 +376,384 @@ inline uint16_t VT100_CURSOR_Y(struct vt100 *t){
 	return y % VT100_SCREEN_HEIGHT;*/
 }
 
+// the bits that a cell holds besides its character in the current colors
+static inline vt100_cell_t _vt100_bits(struct vt100 *t){
+#if VT100_CELL_ATTRS
+	return t->attr << 8;
+#else
+	return (t->attr == VT100_DEFAULT_ATTR)?0:VT100_CELL_COLORED;
+#endif
+}
+
+#if !VT100_CELL_ATTRS
+// attribute of a colored cell in column col of display ram row phys
+#define VT100_ROW_COLOR(t, phys, col) \
+	(((col) < (t)->row_split[phys])?(t)->row_left[phys]:((t)->row_attr[phys] & 0x3f))
+#endif
+
+static inline uint8_t _vt100_cellAttr(struct vt100 *t, uint16_t phys, uint8_t col, vt100_cell_t cell){
+#if VT100_CELL_ATTRS
+	(void)t; (void)phys; (void)col;
+	return cell >> 8;
+#else
+	return (cell & VT100_CELL_COLORED)?VT100_ROW_COLOR(t, phys, col):VT100_DEFAULT_ATTR;
+#endif
+}
+
+static inline vt100_cell_t *_vt100_cells(struct vt100 *t, uint16_t phys){
+	return &t->cells[phys * VT100_COLS(t)];
+}
+
+#define VT100_IS_BLANK(t, phys) ((t)->blank[(phys) >> 3] & _BV((phys) & 7))
+
+// returns the cells of row phys for writing. The cells of an erased row are
+// filled with blanks first
+static vt100_cell_t *_vt100_rowCells(struct vt100 *t, uint16_t phys){
+	vt100_cell_t *cell = _vt100_cells(t, phys);
+	if(VT100_IS_BLANK(t, phys)){
+		t->blank[phys >> 3] &= ~_BV(phys & 7);
+		for(uint16_t c = 0, width = VT100_COLS(t); c < width; c++) cell[c] = VT100_BLANK_CELL;
+#if !VT100_CELL_ATTRS
+		t->row_attr[phys] = VT100_ROW_PLAIN;
+#endif
+	}
+	return cell;
+}
+
+#if !VT100_CELL_ATTRS
+// whether the colored cells among [col, col + n) of display ram row phys are
+// shown in the current attribute, so that the ones that are written again
+// unchanged need no drawing
+static uint8_t _vt100_keepsColor(struct vt100 *t, uint16_t phys, uint8_t col, uint8_t n){
+	uint8_t row = t->row_attr[phys], split = t->row_split[phys];
+	if(row & VT100_ROW_MIXED) return 0;
+	return (t->attr == row && col >= split) || (t->attr == t->row_left[phys] && col + n <= split);
+}
+
+// works out the colors of row phys with cells [col, col + n) in the current
+// attribute (not the default one). Returns 0 when its colored cells would
+// then have more attributes than the row keeps, and otherwise sets the row
+// up for them if apply is set. The cells outside of the range keep the
+// colors they have
+static uint8_t _vt100_fitColor(struct vt100 *t, uint16_t phys, uint8_t col, uint8_t n, uint8_t apply){
+	uint8_t attr = t->attr, row = t->row_attr[phys];
+	if(row == VT100_ROW_PLAIN){
+		if(apply){
+			t->row_attr[phys] = attr;
+			t->row_split[phys] = 0;
+		}
+		return 1;
+	}
+	if(row & VT100_ROW_MIXED) return (row & 0x3f) == attr;
+	if(_vt100_keepsColor(t, phys, col, n)) return 1;
+	// go through the colored cells from the left: the attribute may change
+	// once, which is where the split goes
+	const vt100_cell_t *cell = _vt100_cells(t, phys);
+	uint8_t left = VT100_ROW_PLAIN, right = VT100_ROW_PLAIN, split = 0;
+	for(uint8_t c = 0, width = VT100_COLS(t); c < width; c++){
+		uint8_t a;
+		if(c >= col && c < col + n) a = attr;
+		else if(cell[c] & VT100_CELL_COLORED) a = VT100_ROW_COLOR(t, phys, c);
+		else continue;
+		if(left == VT100_ROW_PLAIN){
+			left = a;
+		} else if(a != ((right == VT100_ROW_PLAIN)?left:right)){
+			if(right != VT100_ROW_PLAIN) return 0;
+			right = a;
+			split = c;
+		}
+	}
+	if(apply){
+		t->row_left[phys] = left;
+		t->row_attr[phys] = (right == VT100_ROW_PLAIN)?left:right;
+		t->row_split[phys] = split;
+	}
+	return 1;
+}
+
+// whether writing cells [col, col + n) of display ram row phys in the
+// current attribute has to wait until the cells pending on the row have been
+// drawn. That is when the row would change to a mixed one or change its
+// attribute while they are waiting, or when on a mixed row the span to draw
+// would grow over colored cells drawn before (their colors are not known).
+// The input then stops before the byte that does it (vt100_term_write
+// returns early), and goes on after a vt100_flush
+static uint8_t _vt100_mustDraw(struct vt100 *t, uint16_t phys, uint8_t col, uint8_t n){
+	uint8_t hi = t->dirty_hi[phys] & ~VT100_ROW_CLEAR, lo = t->dirty_lo[phys];
+	if(!hi || !n) return 0;
+	uint8_t wait = t->attr != VT100_DEFAULT_ATTR && !_vt100_fitColor(t, phys, col, n, 0);
+	if(!wait && t->row_attr[phys] != VT100_ROW_PLAIN && (t->row_attr[phys] & VT100_ROW_MIXED)){
+		const vt100_cell_t *cell = _vt100_cells(t, phys);
+		for(uint8_t c = hi; c < col; c++) wait |= cell[c] & VT100_CELL_COLORED;
+		for(uint8_t c = col + n; c < lo; c++) wait |= cell[c] & VT100_CELL_COLORED;
+	}
+	if(wait){
+		t->flags.wait = 1;
+		t->wait_row = phys;
+	}
+	return wait;
+}
+
+// sets the colors of row phys up for cells [col, col + n) in the current
+// attribute. _vt100_mustDraw has made sure that nothing waiting to be drawn
+// on the row depends on the colors that a mixed row loses
+static void _vt100_paint(struct vt100 *t, uint16_t phys, uint8_t col, uint8_t n){
+	if(t->attr == VT100_DEFAULT_ATTR || _vt100_fitColor(t, phys, col, n, 1)) return;
+	t->row_attr[phys] = t->attr | VT100_ROW_MIXED;
+	t->row_split[phys] = 0;
+}
+#else
+static inline uint8_t _vt100_mustDraw(struct vt100 *t, uint16_t phys, uint8_t col, uint8_t n){
+	(void)t; (void)phys; (void)col; (void)n;
+	return 0;
+}
+#endif
+
+// marks n cells of row phys as changed, to be drawn by the next flush
+static void _vt100_damage(struct vt100 *t, uint16_t phys, uint8_t col, uint8_t n){
+	if(!n) return;
+	uint8_t hi = t->dirty_hi[phys];
+	if(!(hi & ~VT100_ROW_CLEAR)){
+		if(!hi) t->dirty_rows++;
+		t->dirty_lo[phys] = col;
+		t->dirty_hi[phys] = hi | (col + n);
+		return;
+	}
+	if(col < t->dirty_lo[phys]) t->dirty_lo[phys] = col;
+	if(col + n > (hi & ~VT100_ROW_CLEAR)) t->dirty_hi[phys] = (hi & VT100_ROW_CLEAR) | (col + n);
+}
+
+// marks row phys as matching the display (after it has been cleared or drawn)
+static inline void _vt100_undamage(struct vt100 *t, uint16_t phys){
+	if(t->dirty_hi[phys]){
+		t->dirty_hi[phys] = 0;
+		t->dirty_rows--;
+	}
+}
+
+// redraws n cells of display ram row phys from the shadow grid. Cells that
+// share an attribute are drawn as one run, at most VT100_DRAW_CHARS at a time
+static void _vt100_drawCells(struct vt100 *t, uint16_t phys, uint16_t col, uint16_t n){
+	const vt100_cell_t *cell = _vt100_cells(t, phys) + col;
+	uint8_t chars[VT100_DRAW_CHARS];
+	while(n){
+		uint8_t attr = _vt100_cellAttr(t, phys, col, *cell);
+		uint8_t len = 0;
+		while(len < n && len < VT100_DRAW_CHARS && _vt100_cellAttr(t, phys, col + len, cell[len]) == attr){
+			chars[len] = VT100_CELL_CHAR(cell[len]);
+			len++;
+		}
+		ili9340_setFrontColor(pgm_read_word(&_vt100_colors[VT100_ATTR_FG(attr)]));
+		ili9340_setBackColor(pgm_read_word(&_vt100_colors[VT100_ATTR_BG(attr)]));
+		ili9340_drawChars(VT100_PIXEL_X(t, col), VT100_PIXEL_Y(t, phys), chars, len);
+		cell += len;
+		col += len;
+		n -= len;
+	}
+	ili9340_setFrontColor(t->front_color);
+	ili9340_setBackColor(t->back_color);
+}
+
+// clears n columns of display ram row phys from col on
+static void _vt100_fillCols(struct vt100 *t, uint16_t phys, uint8_t col, uint8_t n){
+	ili9340_fillRect(VT100_PIXEL_X(t, col), VT100_PIXEL_Y(t, phys),
+		n * VT100_CHAR_WIDTH, VT100_CHAR_HEIGHT, 0x0000);
+}
+
+// clears the next pixel lines of the run of erased rows (with nothing
+// written since) that starts at display ram row phys. The run is one
+// rectangle, at most split where the scroll area wraps in display ram, and
+// the steps after the first continue it without a new address window
+static void _vt100_clearStep(struct vt100 *t, uint16_t phys){
+	uint16_t rows = 1;
+	while(phys + rows < VT100_ROWS(t) && t->dirty_hi[phys + rows] == VT100_ROW_CLEAR)
+		rows++;
+	// as many whole pixel lines as there are pixels in VT100_FLUSH_COLS columns
+	uint16_t lines = VT100_FLUSH_COLS * VT100_CHAR_WIDTH * VT100_CHAR_HEIGHT / VT100_VIEW_WIDTH(t);
+	if(!lines) lines = 1;
+	uint8_t line = (t->clear_row == phys)?t->clear_line:0;
+	ili9340_fillLines(VT100_LEFT(t), VT100_PIXEL_Y(t, phys), VT100_VIEW_WIDTH(t),
+		rows * VT100_CHAR_HEIGHT, line, lines, 0x0000);
+	line += lines;
+	for(; line >= VT100_CHAR_HEIGHT && rows; line -= VT100_CHAR_HEIGHT, rows--){
+		_vt100_undamage(t, phys);
+		if(t->clear_row == phys) t->clear_row = VT100_NO_ROW;
+		phys++;
+	}
+	if(rows && line){
+		t->clear_row = phys;
+		t->clear_col = 0;
+		t->clear_line = line;
+	}
+}
+
+// does the next VT100_FLUSH_COLS columns of work on row phys: first the
+// clear around the dirty span (resumed at clear_col), then the span itself
+// from the left. The row stays damaged until both are done
+static void _vt100_flushStep(struct vt100 *t, uint16_t phys){
+	if(t->dirty_hi[phys] == VT100_ROW_CLEAR && (t->clear_row != phys || !t->clear_col)){
+		_vt100_clearStep(t, phys);
+		return;
+	}
+	uint8_t hi = t->dirty_hi[phys] & ~VT100_ROW_CLEAR;
+	uint8_t lo = hi?t->dirty_lo[phys]:0;
+	uint8_t budget = VT100_FLUSH_COLS;
+	if(t->dirty_hi[phys] & VT100_ROW_CLEAR){
+		uint8_t col = (t->clear_row == phys)?t->clear_col:0;
+		uint8_t width = VT100_COLS(t), n;
+		if(col < lo){
+			n = (lo - col < budget)?(lo - col):budget;
+			_vt100_fillCols(t, phys, col, n);
+			col += n;
+			budget -= n;
+		}
+		if(col >= lo && col < hi) col = hi;
+		if(budget && col < width){
+			n = (width - col < budget)?(width - col):budget;
+			_vt100_fillCols(t, phys, col, n);
+			col += n;
+			budget -= n;
+		}
+		if(col < width){
+			t->clear_row = phys;
+			t->clear_col = col;
+			return;
+		}
+		t->clear_row = VT100_NO_ROW;
+		t->dirty_hi[phys] = hi;
+		if(!hi){
+			t->dirty_rows--;
+			return;
+		}
+	}
+	if(!budget) return;
+	if(hi - lo > budget){
+		_vt100_drawCells(t, phys, lo, budget);
+		t->dirty_lo[phys] = lo + budget;
+		return;
+	}
+	_vt100_drawCells(t, phys, lo, hi - lo);
+	_vt100_undamage(t, phys);
+}
+
+// erases the given lines. This only sets a bit for each line: the cells are
+// blanked when the line is written to again, and the display is cleared by
+// the next flush around whatever has been written by then
 void _vt100_clearLines(struct vt100 *t, uint16_t start_line, uint16_t end_line){
-	for(int c = start_line; c <= end_line; c++){
-		uint16_t cy = t->cursor_y;
-		t->cursor_y = c; 
-		ili9340_fillRect(0, VT100_CURSOR_Y(t), VT100_SCREEN_WIDTH, VT100_CHAR_HEIGHT, 0x0000);
-		t->cursor_y = cy;
+	for(uint16_t c = start_line; c <= end_line && c < VT100_ROWS(t); c++){
+		uint16_t phys = _vt100_physRow(t, c);
+		t->blank[phys >> 3] |= _BV(phys & 7);
+		if(!t->dirty_hi[phys]) t->dirty_rows++;
+		t->dirty_hi[phys] = VT100_ROW_CLEAR;
+		if(t->clear_row == phys) t->clear_row = VT100_NO_ROW;
+	}
+}
+
+// moves the lines from screen row y to the bottom of the scroll region up
+// (n > 0) or down (n < 0) by n rows in the cell grid, and erases the n lines
+// that are left behind. Every line that moves is redrawn
+static void _vt100_moveLines(struct vt100 *t, int16_t y, int16_t n){
+	int16_t end = t->scroll_end_row;
+	if(n > 0){
+		for(int16_t r = y; r < end - n; r++) _vt100_copyLine(t, r, r + n);
+		_vt100_clearLines(t, end - n, end - 1);
+	} else {
+		for(int16_t r = end - 1; r >= y - n; r--) _vt100_copyLine(t, r, r + n);
+		_vt100_clearLines(t, y, y - n - 1);
+	}
+}
+
+// swaps display ram rows a and b of the cell grid, together with their
+// erased bit and row colors
+static void _vt100_swapRows(struct vt100 *t, uint16_t a, uint16_t b){
+	uint8_t blank_a = VT100_IS_BLANK(t, a), blank_b = VT100_IS_BLANK(t, b);
+	if(!blank_a || !blank_b){
+		vt100_cell_t *p = _vt100_cells(t, a), *q = _vt100_cells(t, b);
+		for(uint16_t c = 0, width = VT100_COLS(t); c < width; c++){
+			vt100_cell_t cell = p[c];
+			p[c] = q[c];
+			q[c] = cell;
+		}
+	}
+	t->blank[a >> 3] &= ~_BV(a & 7);
+	t->blank[b >> 3] &= ~_BV(b & 7);
+	if(blank_b) t->blank[a >> 3] |= _BV(a & 7);
+	if(blank_a) t->blank[b >> 3] |= _BV(b & 7);
+#if !VT100_CELL_ATTRS
+	uint8_t *colors[] = {t->row_attr, t->row_left, t->row_split};
+	for(uint8_t i = 0; i < 3; i++){
+		uint8_t color = colors[i][a];
+		colors[i][a] = colors[i][b];
+		colors[i][b] = color;
+	}
+#endif
+}
+
+// stores every row of the scroll region at its own screen row again and
+// sets the scroll value to 0. The scroll value only means something for the
+// region it was counted in, so this comes before the region changes. The
+// rows are rotated in place (three reversals, no row buffer) and all of
+// them are redrawn by the next flush, which also sends the new scroll start
+static void _vt100_unscroll(struct vt100 *t){
+	uint16_t start = t->scroll_start_row, end = t->scroll_end_row;
+	uint16_t mid = start + t->scroll_value;
+	if(!t->scroll_value) return;
+	for(uint16_t a = start, b = mid - 1; a < b; a++, b--) _vt100_swapRows(t, a, b);
+	for(uint16_t a = mid, b = end - 1; a < b; a++, b--) _vt100_swapRows(t, a, b);
+	for(uint16_t a = start, b = end - 1; a < b; a++, b--) _vt100_swapRows(t, a, b);
+	t->scroll_value = 0;
+	t->scroll_pending = 1;
+	t->clear_row = VT100_NO_ROW;
+	for(uint16_t row = start; row < end; row++){
+		_vt100_undamage(t, row);
+		if(VT100_IS_BLANK(t, row)) _vt100_clearLines(t, row, row);
+		else _vt100_damage(t, row, 0, VT100_COLS(t));
 	}
-	/*uint16_t start = ((start_line * t->char_height) + t->scroll) % VT100_SCREEN_HEIGHT;
-	uint16_t h = (end_line - start_line) * VT100_CHAR_HEIGHT;
-	ili9340_fillRect(0, start, VT100_SCREEN_WIDTH, h, 0x0000); */
+	_vt100_trackRow(t);
 }
 
-// scrolls the scroll region up (lines > 0) or down (lines < 0)
+// scrolls the scroll region up (lines > 0) or down (lines < 0). Only the
+// model is updated here: the lines that scroll in are erased and the new
+// scroll start is sent by the next flush. When output
+// arrives faster than it can be drawn, the lines that scroll through the
+// screen between two flushes are never drawn at all (jump scrolling)
 void _vt100_scroll(struct vt100 *t, int16_t lines){
 	if(!lines) return;
 
 	// get height of scroll area in rows
-	uint16_t scroll_height = t->scroll_end_row - t->scroll_start_row; 
+	int16_t scroll_height = t->scroll_end_row - t->scroll_start_row; 
+	if(lines > scroll_height) lines = scroll_height;
+	if(lines < -scroll_height) lines = -scroll_height;
+	if(!VT100_HW_SCROLL(t)){
+		// the display has one scroll area, which a pane can't use (nor a
+		// terminal in landscape). Its lines are moved in the cell grid
+		// instead and redrawn by the next flush
+		_vt100_moveLines(t, t->scroll_start_row, lines);
+		_vt100_trackRow(t);
+		return;
+	}
 	// clearing of lines that we have scrolled up or down
 	if(lines > 0){
 		_vt100_clearLines(t, t->scroll_start_row, t->scroll_start_row+lines-1); 
-		// update the scroll value (wraps around scroll_height)
-		t->scroll_value = (t->scroll_value + lines) % scroll_height;
+		// update the scroll value (wraps around scroll_height, lines is at
+		// most scroll_height so one subtraction does)
+		t->scroll_value += lines;
+		if(t->scroll_value >= scroll_height) t->scroll_value -= scroll_height;
 		// scrolling up so clear first line of scroll area
 		//uint16_t y = (t->scroll_start_row + t->scroll_value) * VT100_CHAR_HEIGHT; 
 		//ili9340_fillRect(0, y, VT100_SCREEN_WIDTH, lines * VT100_CHAR_HEIGHT, 0x0000);
 	} else if(lines < 0){
-		_vt100_clearLines(t, t->scroll_end_row - lines, t->scroll_end_row - 1); 
+		// the bottom lines wrap around to become the new top lines
+		_vt100_clearLines(t, t->scroll_end_row + lines, t->scroll_end_row - 1); 
 		// make sure that the value wraps down 
-		t->scroll_value = (scroll_height + t->scroll_value + lines) % scroll_height; 
+		t->scroll_value += scroll_height + lines;
+		if(t->scroll_value >= scroll_height) t->scroll_value -= scroll_height;
 		// scrolling down - so clear last line of the scroll area
 		//uint16_t y = (t->scroll_start_row + t->scroll_value) * VT100_CHAR_HEIGHT; 
 		//ili9340_fillRect(0, y, VT100_SCREEN_WIDTH, lines * VT100_CHAR_HEIGHT, 0x0000);
 	}
-	uint16_t scroll_start = (t->scroll_start_row + t->scroll_value) * VT100_CHAR_HEIGHT; 
-	ili9340_setScrollStart(scroll_start); 
+	t->scroll_pending = 1; 
+	_vt100_trackRow(t);
 	
 	/*
 	int16_t pixels = lines * VT100_CHAR_HEIGHT;
@@ -211,17 +777,28 @@ void _vt100_scroll(struct vt100 *t, int16_t lines){
 // moves the cursor relative to current cursor position and scrolls the screen
 void _vt100_move(struct vt100 *term, int16_t right_left, int16_t bottom_top){
 	// calculate how many lines we need to move down or up if x movement goes outside screen
+	// (moves are a few columns at most, so the lines are counted off by
+	// subtracting instead of dividing)
 	int16_t new_x = right_left + term->cursor_x; 
-	if(new_x > VT100_WIDTH){
+	int16_t width = VT100_COLS(term);
+	if(new_x > width){
 		if(term->flags.cursor_wrap){
-			bottom_top += new_x / VT100_WIDTH;
-			term->cursor_x = new_x % VT100_WIDTH - 1;
+			while(new_x >= width){
+				new_x -= width;
+				bottom_top++;
+			}
+			term->cursor_x = new_x - 1;
 		} else {
-			term->cursor_x = VT100_WIDTH;
+			term->cursor_x = width;
 		}
 	} else if(new_x < 0){
-		bottom_top += new_x / VT100_WIDTH - 1;
-		term->cursor_x = VT100_WIDTH - (abs(new_x) % VT100_WIDTH) + 1; 
+		new_x = -new_x;
+		bottom_top--;
+		while(new_x >= width){
+			new_x -= width;
+			bottom_top--;
+		}
+		term->cursor_x = width - new_x + 1; 
 	} else {
 		term->cursor_x = new_x;
 	}
@@ -250,7 +827,8 @@ void _vt100_move(struct vt100 *term, int16_t right_left, int16_t bottom_top){
 			// otherwise we move as normal inside the screen
 			term->cursor_y = new_y;
 		}
-		_vt100_scroll(term, to_scroll);
+		if(to_scroll) _vt100_scroll(term, to_scroll);
+		else _vt100_trackRow(term);
 	}
 }
 
@@ -261,10 +839,84 @@ void _vt100_drawCursor(struct vt100 *t){
 	//ili9340_fillRect(x, y, t->char_width, t->char_height, t->front_color); 
 }
 
+// stores n characters in the current colors into row phys starting at col.
+// Characters that the cells already hold are not marked for drawing at all,
+// which is most of the text when full screen programs repaint; the changed
+// ones extend the damaged span of the row
+static void _vt100_storeRun(struct vt100 *t, uint16_t phys, uint16_t col, const uint8_t *str, uint16_t n){
+	if(_vt100_mustDraw(t, phys, col, n)) return;
+	vt100_cell_t *cell = _vt100_rowCells(t, phys) + col;
+	vt100_cell_t bits = _vt100_bits(t);
+#if VT100_CELL_ATTRS
+	uint8_t can_skip = 1;
+#else
+	// colored cells are only known to show the current colors if they are on
+	// the side of the row's split that has them (tested before this run
+	// changes it)
+	uint8_t can_skip = !bits || _vt100_keepsColor(t, phys, col, n);
+	_vt100_paint(t, phys, col, n);
+#endif
+
+	VT100_STAT(glyphs += n);
+	uint16_t first = n, last = 0;
+	for(uint16_t c = 0; c < n; c++){
+		vt100_cell_t want = str[c] | bits;
+		if(can_skip && cell[c] == want){
+			VT100_STAT(elided++);
+			continue;
+		}
+		cell[c] = want;
+		if(first == n) first = c;
+		last = c + 1;
+	}
+	if(last) _vt100_damage(t, phys, col + first, last - first);
+}
+
+// erases n cells of row phys starting at col to blanks in the current
+// colors. Like _vt100_storeRun, only cells that change are marked for drawing
+static void _vt100_eraseCells(struct vt100 *t, uint16_t phys, uint16_t col, uint16_t n){
+	if(_vt100_mustDraw(t, phys, col, n)) return;
+	vt100_cell_t *cell = _vt100_rowCells(t, phys) + col;
+	vt100_cell_t blank = ' ' | _vt100_bits(t);
+#if VT100_CELL_ATTRS
+	uint8_t can_skip = 1;
+#else
+	uint8_t can_skip = blank == ' ' || _vt100_keepsColor(t, phys, col, n);
+	_vt100_paint(t, phys, col, n);
+#endif
+
+	uint16_t first = n, last = 0;
+	for(uint16_t c = 0; c < n; c++){
+		if(can_skip && cell[c] == blank) continue;
+		cell[c] = blank;
+		if(first == n) first = c;
+		last = c + 1;
+	}
+	if(last) _vt100_damage(t, phys, col + first, last - first);
+}
+
+uint16_t _vt100_putRun(struct vt100 *t, const uint8_t *str, uint16_t len);
+
+// whether printing n characters at the cursor (a line of them at most) has
+// to wait for a row to be drawn, see _vt100_mustDraw. The character that
+// finds the cursor past the last column is dropped and the rest wraps onto
+// the next line, which scrolls in blank at the bottom of the scroll region
+static uint8_t _vt100_mustDrawText(struct vt100 *t, uint8_t n){
+	uint16_t width = VT100_COLS(t), x = t->cursor_x;
+	uint8_t fit = (x < width)?width - x:0;
+	if(fit && t->cursor_y < VT100_ROWS(t) &&
+		_vt100_mustDraw(t, t->cursor_phys, x, (n < fit)?n:fit)) return 1;
+	int16_t y = t->cursor_y + 1;
+	if(n <= fit + 1 || !t->flags.cursor_wrap || y < t->scroll_start_row || y >= t->scroll_end_row)
+		return 0;
+	return _vt100_mustDraw(t, _vt100_physRow(t, y), 0, n - fit - 1);
+}
+
 // sends the character to the display and updates cursor position
 void _vt100_putc(struct vt100 *t, uint8_t ch){
 	if(ch < 0x20 || ch > 0x7e){
 		static const char hex[] = "0123456789abcdef"; 
+		if(_vt100_mustDrawText(t, 4)) return;
 		_vt100_putc(t, '0'); 
 		_vt100_putc(t, 'x'); 
 		_vt100_putc(t, hex[((ch & 0xf0) >> 4)]);
@@ -272,578 +924,875 @@ void _vt100_putc(struct vt100 *t, uint8_t ch){
 		return;
 	}
 	
-	// calculate current cursor position in the display ram
-	uint16_t x = VT100_CURSOR_X(t);
-	uint16_t y = VT100_CURSOR_Y(t);
+	_vt100_putRun(t, &ch, 1); 
+}
+
+// draws a run of printable characters starting at the cursor. Colors and the
+// display row are set up once, and the part of the run that fits on the
+// current line goes through _vt100_storeRun. Only when the cursor reaches the
+// right edge do we go through _vt100_move so that wrapping and scrolling
+// happen. Returns the number of characters taken, which is less than len
+// when the rest has to wait for a row to be drawn
+uint16_t _vt100_putRun(struct vt100 *t, const uint8_t *str, uint16_t len){
+	uint16_t width = VT100_COLS(t), total = len;
 
 	ili9340_setFrontColor(t->front_color);
 	ili9340_setBackColor(t->back_color); 
-	ili9340_drawChar(x, y, ch);
 
-	// move cursor right
-	_vt100_move(t, 1, 0); 
+	while(len){
+		if(t->cursor_x < width){
+			uint16_t n = width - t->cursor_x;
+			if(n > len) n = len;
+			// below the last line there is no cell to keep the text in, and
+			// drawing it straight to the display would leave pixels that the
+			// flushes neither track nor clear, so it is dropped
+			if(t->cursor_y < VT100_ROWS(t)){
+				_vt100_storeRun(t, t->cursor_phys, t->cursor_x, str, n);
+				if(t->flags.wait) break;
+			}
+			t->cursor_x += n;
+			str += n;
+			len -= n;
+		} else {
+			// so is a character with the cursor past the last column. The
+			// cursor still moves on, to the next line when wrapping is on
+			str++;
+			_vt100_move(t, 1, 0);
+			len--;
+		}
+	}
 	_vt100_drawCursor(t); 
+	return total - len;
 }
 
-void vt100_puts(const char *str){
-	while(*str){
-		vt100_putc(*str++);
-	}
-}
-
-STATE(_st_command_arg, term, ev, arg){
-	switch(ev){
-		case EV_CHAR: {
-			if(isdigit(arg)){ // a digit argument
-				term->args[term->narg] = term->args[term->narg] * 10 + (arg - '0');
-			} else if(arg == ';') { // separator
-				term->narg++;
-			} else { // no more arguments
-				// go back to command state 
-				term->narg++;
-				if(term->ret_state){
-					term->state = term->ret_state;
-				}
-				else {
-					term->state = _st_idle;
-				}
-				// execute next state as well because we have already consumed a char!
-				term->state(term, ev, arg);
-			}
-			break;
+// deletes (n > 0) or inserts (n < 0) characters at the cursor. The rest of
+// the line moves left or right and blanks fill the vacated cells. Only the
+// cells from the cursor to the end of the line need to be redrawn
+void _vt100_shiftChars(struct vt100 *t, int16_t n){
+	uint16_t width = VT100_COLS(t);
+	uint16_t x = t->cursor_x;
+	if(x >= width || t->cursor_y >= VT100_ROWS(t) || !n) return;
+
+	uint16_t count = abs(n);
+	if(count > width - x) count = width - x;
+	uint16_t phys = t->cursor_phys;
+	uint16_t tail = width - x;
+	if(_vt100_mustDraw(t, phys, x, tail)) return;
+	vt100_cell_t blank = ' ' | _vt100_bits(t);
+#if !VT100_CELL_ATTRS
+	// where the colored blanks go the colors of the row are only worked out
+	// after the shift, so that has to wait for what is pending on the row
+	if(blank != ' ' && t->row_attr[phys] != VT100_ROW_PLAIN &&
+		(t->dirty_hi[phys] & ~VT100_ROW_CLEAR)){
+		t->flags.wait = 1;
+		t->wait_row = phys;
+		return;
+	}
+#endif
+	vt100_cell_t *cell = _vt100_rowCells(t, phys) + x;
+#if !VT100_CELL_ATTRS
+	// the vacated cells, relative to the cursor
+	uint16_t gap = (n > 0)?tail - count:0;
+	// the split moves with the cells right of the cursor. A colored cell that
+	// stays as it is keeps its colors if it is not between the old and the
+	// new split and not a new blank. On a mixed row they are not known
+	uint8_t split = t->row_split[phys], moved = split;
+	if(split > x){
+		if(n > 0) moved = (split - x > count)?split - count:x;
+		else moved = (split + count < width)?split + count:width;
+	}
+	t->row_split[phys] = moved;
+	uint8_t can_skip_lo = (split < moved)?split:moved, can_skip_hi = (split < moved)?moved:split;
+	if(t->row_attr[phys] & VT100_ROW_MIXED){
+		can_skip_lo = 0;
+		can_skip_hi = width;
+	}
+#endif
+
+	// shift the tail in place and only damage the cells that end up
+	// different, so that the blanks after the end of the text (and any
+	// repeated characters) are not redrawn
+	uint16_t first = tail, last = 0;
+	for(uint16_t i = 0; i < tail; i++){
+		// deleting moves cells left and is done from the left, inserting the
+		// other way round, so that every cell is read before it is replaced
+		uint16_t c = (n > 0)?i:tail - 1 - i;
+		vt100_cell_t want;
+		if(n > 0) want = (c + count < tail)?cell[c + count]:blank;
+		else want = (c >= count)?cell[c - count]:blank;
+		if(cell[c] == want){
+#if VT100_CELL_ATTRS
+			continue;
+#else
+			if(!(want & VT100_CELL_COLORED)) continue;
+			if((c < gap || c >= gap + count) && (x + c < can_skip_lo || x + c >= can_skip_hi)) continue;
+#endif
 		}
+		cell[c] = want;
+		if(c < first) first = c;
+		if(c + 1 > last) last = c + 1;
 	}
+#if !VT100_CELL_ATTRS
+	_vt100_paint(t, phys, x + gap, count);
+#endif
+	if(last) _vt100_damage(t, phys, x + first, last - first);
 }
 
-STATE(_st_esc_sq_bracket, term, ev, arg){
-	switch(ev){
-		case EV_CHAR: {
-			if(isdigit(arg)){ // start of an argument
-				term->ret_state = _st_esc_sq_bracket; 
-				_st_command_arg(term, ev, arg);
-				term->state = _st_command_arg;
-			} else if(arg == ';'){ // arg separator. 
-				// skip. And also stay in the command state
-			} else { // otherwise we execute the command and go back to idle
-				switch(arg){
-					case 'A': {// move cursor up (cursor stops at top margin)
-						int n = (term->narg > 0)?term->args[0]:1;
-						term->cursor_y -= n;
-						if(term->cursor_y < 0) term->cursor_y = 0; 
-						term->state = _st_idle; 
-						break;
-					} 
-					case 'B': { // cursor down (cursor stops at bottom margin)
-						int n = (term->narg > 0)?term->args[0]:1;
-						term->cursor_y += n;
-						if(term->cursor_y > VT100_HEIGHT) term->cursor_y = VT100_HEIGHT; 
-						term->state = _st_idle; 
-						break;
-					}
-					case 'C': { // cursor right (cursor stops at right margin)
-						int n = (term->narg > 0)?term->args[0]:1;
-						term->cursor_x += n;
-						if(term->cursor_x > VT100_WIDTH) term->cursor_x = VT100_WIDTH;
-						term->state = _st_idle; 
-						break;
-					}
-					case 'D': { // cursor left
-						int n = (term->narg > 0)?term->args[0]:1;
-						term->cursor_x -= n;
-						if(term->cursor_x < 0) term->cursor_x = 0;
-						term->state = _st_idle; 
-						break;
-					}
-					case 'f': 
-					case 'H': { // move cursor to position (default 0;0)
-						// cursor stops at respective margins
-						term->cursor_x = (term->narg >= 1)?(term->args[1]-1):0; 
-						term->cursor_y = (term->narg == 2)?(term->args[0]-1):0;
-						if(term->flags.origin_mode) {
-							term->cursor_y += term->scroll_start_row;
-							if(term->cursor_y >= term->scroll_end_row){
-								term->cursor_y = term->scroll_end_row - 1;
-							}
-						}
-						if(term->cursor_x > VT100_WIDTH) term->cursor_x = VT100_WIDTH;
-						if(term->cursor_y > VT100_HEIGHT) term->cursor_y = VT100_HEIGHT; 
-						term->state = _st_idle; 
-						break;
-					}
-					case 'J':{// clear screen from cursor up or down
-						uint16_t y = VT100_CURSOR_Y(term); 
-						if(term->narg == 0 || (term->narg == 1 && term->args[0] == 0)){
-							// clear down to the bottom of screen (including cursor)
-							_vt100_clearLines(term, term->cursor_y, VT100_HEIGHT); 
-						} else if(term->narg == 1 && term->args[0] == 1){
-							// clear top of screen to current line (including cursor)
-							_vt100_clearLines(term, 0, term->cursor_y); 
-						} else if(term->narg == 1 && term->args[0] == 2){
-							// clear whole screen
-							_vt100_clearLines(term, 0, VT100_HEIGHT);
-							// reset scroll value
-							_vt100_resetScroll(); 
-						}
-						term->state = _st_idle; 
-						break;
-					}
-					case 'K':{// clear line from cursor right/left
-						uint16_t x = VT100_CURSOR_X(term);
-						uint16_t y = VT100_CURSOR_Y(term);
-
-						if(term->narg == 0 || (term->narg == 1 && term->args[0] == 0)){
-							// clear to end of line (to \n or to edge?)
-							// including cursor
-							ili9340_fillRect(x, y, VT100_SCREEN_WIDTH - x, VT100_CHAR_HEIGHT, term->back_color);
-						} else if(term->narg == 1 && term->args[0] == 1){
-							// clear from left to current cursor position
-							ili9340_fillRect(0, y, x + VT100_CHAR_WIDTH, VT100_CHAR_HEIGHT, term->back_color);
-						} else if(term->narg == 1 && term->args[0] == 2){
-							// clear whole current line
-							ili9340_fillRect(0, y, VT100_SCREEN_WIDTH, VT100_CHAR_HEIGHT, term->back_color);
-						}
-						term->state = _st_idle; 
-						break;
-					}
-					
-					case 'L': // insert lines (args[0] = number of lines)
-					case 'M': // delete lines (args[0] = number of lines)
-						term->state = _st_idle;
-						break; 
-					case 'P': {// delete characters args[0] or 1 in front of cursor
-						// TODO: this needs to correctly delete n chars
-						int n = ((term->narg > 0)?term->args[0]:1);
-						_vt100_move(term, -n, 0);
-						for(int c = 0; c < n; c++){
-							_vt100_putc(term, ' ');
-						}
-						term->state = _st_idle;
-						break;
-					}
-					case 'c':{ // query device code
-						term->send_response("\e[?1;0c"); 
-						term->state = _st_idle; 
-						break; 
-					}
-					case 'x': {
-						term->state = _st_idle;
-						break;
-					}
-					case 's':{// save cursor pos
-						term->saved_cursor_x = term->cursor_x;
-						term->saved_cursor_y = term->cursor_y;
-						term->state = _st_idle; 
-						break;
-					}
-					case 'u':{// restore cursor pos
-						term->cursor_x = term->saved_cursor_x;
-						term->cursor_y = term->saved_cursor_y; 
-						//_vt100_moveCursor(term, term->saved_cursor_x, term->saved_cursor_y);
-						term->state = _st_idle; 
-						break;
-					}
-					case 'h':
-					case 'l': {
-						term->state = _st_idle;
-						break;
-					}
-					
-					case 'g': {
-						term->state = _st_idle;
-						break;
-					}
-					case 'm': { // sets colors. Accepts up to 3 args
-						// [m means reset the colors to default
-						if(!term->narg){
-							term->front_color = 0xffff;
-							term->back_color = 0x0000;
-						}
-						while(term->narg){
-							term->narg--; 
-							int n = term->args[term->narg];
-							static const uint16_t colors[] = {
-								0x0000, // black
-								0xf800, // red
-								0x0780, // green
-								0xfe00, // yellow
-								0x001f, // blue
-								0xf81f, // magenta
-								0x07ff, // cyan
-								0xffff // white
-							};
-							if(n == 0){ // all attributes off
-								term->front_color = 0xffff;
-								term->back_color = 0x0000;
-								
-								ili9340_setFrontColor(term->front_color);
-								ili9340_setBackColor(term->back_color);
-							}
-							if(n >= 30 && n < 38){ // fg colors
-								term->front_color = colors[n-30]; 
-								ili9340_setFrontColor(term->front_color);
-							} else if(n >= 40 && n < 48){
-								term->back_color = colors[n-40]; 
-								ili9340_setBackColor(term->back_color); 
-							}
-						}
-						term->state = _st_idle; 
-						break;
-					}
-					
-					case '@': // Insert Characters          
-						term->state = _st_idle;
-						break; 
-					case 'r': // Set scroll region (top and bottom margins)
-						// the top value is first row of scroll region
-						// the bottom value is the first row of static region after scroll
-						if(term->narg == 2 && term->args[0] < term->args[1]){
-							// [1;40r means scroll region between 8 and 312
-							// bottom margin is 320 - (40 - 1) * 8 = 8 pix
-							term->scroll_start_row = term->args[0] - 1;
-							term->scroll_end_row = term->args[1] - 1; 
-							uint16_t top_margin = term->scroll_start_row * VT100_CHAR_HEIGHT;
-							uint16_t bottom_margin = VT100_SCREEN_HEIGHT -
-								(term->scroll_end_row * VT100_CHAR_HEIGHT); 
-							ili9340_setScrollMargins(top_margin, bottom_margin);
-							//ili9340_setScrollStart(0); // reset scroll 
-						} else {
-							_vt100_resetScroll(); 
-						}
-						term->state = _st_idle; 
-						break;  
-					case 'i': // Printing  
-					case 'y': // self test modes..
-					case '=':{ // argument follows... 
-						//term->state = _st_screen_mode;
-						term->state = _st_idle; 
-						break; 
-					}
-					case '?': // '[?' escape mode
-						term->state = _st_esc_question;
-						break; 
-					default: { // unknown sequence
-						
-						term->state = _st_idle;
-						break;
-					}
-				}
-				//term->state = _st_idle;
-			} // else
-			break;
-		}
-		default: { // switch (ev)
-			// for all other events restore normal mode
-			term->state = _st_idle; 
+// copies the cells of screen row src to screen row dst
+static void _vt100_copyLine(struct vt100 *t, uint16_t dst, uint16_t src){
+	uint16_t from = _vt100_physRow(t, src), to = _vt100_physRow(t, dst);
+	if(VT100_IS_BLANK(t, from)){
+		_vt100_clearLines(t, dst, dst);
+		return;
+	}
+	t->blank[to >> 3] &= ~_BV(to & 7);
+	memcpy(_vt100_cells(t, to), _vt100_cells(t, from), VT100_COLS(t) * sizeof(vt100_cell_t));
+#if !VT100_CELL_ATTRS
+	t->row_attr[to] = t->row_attr[from];
+	t->row_left[to] = t->row_left[from];
+	t->row_split[to] = t->row_split[from];
+#endif
+	_vt100_damage(t, to, 0, VT100_COLS(t));
+}
+
+// deletes (n > 0) or inserts (n < 0) lines at the cursor row. Lines between
+// the cursor and the bottom of the scroll region move up or down and blank
+// lines fill the vacated rows. Nothing happens outside of the scroll region
+void _vt100_shiftLines(struct vt100 *t, int16_t n){
+	int16_t y = t->cursor_y, end = t->scroll_end_row;
+	if(y < t->scroll_start_row || y >= end || !n) return;
+
+	int16_t count = abs(n);
+	if(count > end - y) count = end - y;
+	int16_t above = y - t->scroll_start_row;
+	if(VT100_HW_SCROLL(t) && above < end - y - count){
+		// Every line that is moved gets redrawn, so when fewer lines sit above
+		// the cursor than below it the whole region is scrolled in hardware
+		// instead, and only the lines above the cursor are moved back. With
+		// the cursor on the top line (vim, less) that leaves one cleared row
+		if(n > 0){
+			for(int16_t r = y - 1; r >= y - above; r--) _vt100_copyLine(t, r + count, r);
+			_vt100_scroll(t, count);
+		} else {
+			_vt100_scroll(t, -count);
+			for(int16_t r = y - above; r < y; r++) _vt100_copyLine(t, r, r + count);
+			_vt100_clearLines(t, y, y + count - 1);
 		}
+	} else {
+		_vt100_moveLines(t, y, (n > 0)?count:-count);
 	}
+	t->cursor_x = 0;
 }
 
-STATE(_st_esc_question, term, ev, arg){
-	// DEC mode commands
-	switch(ev){
-		case EV_CHAR: {
-			if(isdigit(arg)){ // start of an argument
-				term->ret_state = _st_esc_question; 
-				_st_command_arg(term, ev, arg);
-				term->state = _st_command_arg;
-			} else if(arg == ';'){ // arg separator. 
-				// skip. And also stay in the command state
-			} else {
-				switch(arg) {
-					case 'l': 
-						// dec mode: OFF (arg[0] = function)
-					case 'h': {
-						// dec mode: ON (arg[0] = function)
-						switch(term->args[0]){
-							case 1: { // cursor keys mode
-								// h = esc 0 A for cursor up
-								// l = cursor keys send ansi commands
-								break;
-							}
-							case 2: { // ansi / vt52
-								// h = ansi mode
-								// l = vt52 mode
-								break;
-							}
-							case 3: {
-								// h = 132 chars per line
-								// l = 80 chars per line
-								break;
-							}
-							case 4: {
-								// h = smooth scroll
-								// l = jump scroll
-								break;
-							}
-							case 5: {
-								// h = black on white bg
-								// l = white on black bg
-								break;
-							}
-							case 6: {
-								// h = cursor relative to scroll region
-								// l = cursor independent of scroll region
-								term->flags.origin_mode = (arg == 'h')?1:0; 
-								break;
-							}
-							case 7: {
-								// h = new line after last column
-								// l = cursor stays at the end of line
-								term->flags.cursor_wrap = (arg == 'h')?1:0; 
-								break;
-							}
-							case 8: {
-								// h = keys will auto repeat
-								// l = keys do not auto repeat when held down
-								break;
-							}
-							case 9: {
-								// h = display interlaced
-								// l = display not interlaced
-								break;
-							}
-							// 10-38 - all quite DEC speciffic commands so omitted here
-						}
-						term->state = _st_idle;
-						break; 
-					}
-					case 'i': /* Printing */  
-					case 'n': /* Request printer status */
-					default:  
-						term->state = _st_idle; 
-						break;
-				}
-				term->state = _st_idle;
-			}
+uint8_t vt100_term_flush(vt100_t *t, uint8_t max_steps){
+	if(t->scroll_pending){
+		ili9340_setScrollStart((t->scroll_start_row + t->scroll_value) * VT100_CHAR_HEIGHT);
+		t->scroll_pending = 0;
+	}
+#if !VT100_CELL_ATTRS
+	// the row the input waits for goes first
+	for(uint8_t row = t->wait_row; t->flags.wait && max_steps && t->dirty_hi[row];){
+		if(max_steps != VT100_FLUSH_ALL) max_steps--;
+		_vt100_flushStep(t, row);
+	}
+#endif
+	// a row that is not finished in one step is continued by the next one
+	for(uint8_t row = 0; t->dirty_rows && row < VT100_MAX_ROWS;){
+		if(!t->dirty_hi[row]){
+			row++;
+			continue;
 		}
+		if(!max_steps) break;
+		if(max_steps != VT100_FLUSH_ALL) max_steps--;
+		_vt100_flushStep(t, row);
 	}
+	return t->dirty_rows;
 }
 
-STATE(_st_esc_left_br, term, ev, arg){
-	switch(ev){
-		case EV_CHAR: {
-			switch(arg) {  
-				case 'A':  
-				case 'B':  
-					// translation map command?
-				case '0':  
-				case 'O':
-					// another translation map command?
-					term->state = _st_idle;
-					break;
-				default:
-					term->state = _st_idle;
-			}
-			//term->state = _st_idle;
+uint8_t vt100_flush(uint8_t max_steps){
+	return vt100_term_flush(&_vt100_terms[0], max_steps);
+}
+
+uint8_t vt100_flush_all(uint8_t max_steps){
+	// the terminals take turns a step at a time, so a terminal with a lot to
+	// draw does not hold up the others. idle counts the terminals in a row
+	// that had nothing to draw
+	uint8_t idle = 0, pending = 0;
+	while(idle < VT100_INSTANCES){
+		struct vt100 *t = &_vt100_terms[_vt100_turn];
+		if(t->flags.open && (t->dirty_rows || t->scroll_pending)){
+			if(!max_steps) break;
+			if(max_steps != VT100_FLUSH_ALL) max_steps--;
+			vt100_term_flush(t, 1);
+			idle = 0;
+		} else {
+			idle++;
 		}
+		if(++_vt100_turn == VT100_INSTANCES) _vt100_turn = 0;
 	}
+	for(uint8_t i = 0; i < VT100_INSTANCES; i++) pending += _vt100_terms[i].dirty_rows;
+	return pending;
 }
 
-STATE(_st_esc_right_br, term, ev, arg){
-	switch(ev){
-		case EV_CHAR: {
-			switch(arg) {  
-				case 'A':  
-				case 'B':  
-					// translation map command?
-				case '0':  
-				case 'O':
-					// another translation map command?
-					term->state = _st_idle;
-					break;
-				default:
-					term->state = _st_idle;
-			}
-			//term->state = _st_idle;
+// feeds all of the buffer to terminal t, drawing a step whenever the input
+// has to wait for a row
+static void _vt100_writeAll(struct vt100 *t, const uint8_t *buf, size_t len){
+	for(size_t n; (n = vt100_term_write(t, buf, len)) < len; buf += n, len -= n)
+		vt100_term_flush(t, 1);
+}
+
+void vt100_term_puts(vt100_t *t, const char *str){
+	_vt100_writeAll(t, (const uint8_t*)str, strlen(str));
+	vt100_term_flush(t, VT100_FLUSH_ALL);
+}
+
+void vt100_puts(const char *str){
+	vt100_term_puts(&_vt100_terms[0], str);
+}
+
+void vt100_puts_P(const char *str){
+	// copied out in small pieces so that runs can still be drawn at once
+	uint8_t buf[16];
+	uint8_t len = 0;
+	while((buf[len] = pgm_read_byte(str++))){
+		if(++len == sizeof(buf)){
+			_vt100_writeAll(&_vt100_terms[0], buf, len);
+			len = 0;
 		}
 	}
+	_vt100_writeAll(&_vt100_terms[0], buf, len);
+	vt100_flush(VT100_FLUSH_ALL);
 }
 
-STATE(_st_esc_hash, term, ev, arg){
-	switch(ev){
-		case EV_CHAR: {
-			switch(arg) {  
-				case '8': {
-					// self test: fill the screen with 'E'
-					
-					term->state = _st_idle;
-					break;
-				}
-				default:
-					term->state = _st_idle;
-			}
+// byte classes of the parser. Bytes from 0x80 up are CL_HIGH
+enum {
+	CL_CTRL, // C0 controls without a class of their own
+	CL_CAN, // CAN and SUB, abort a sequence
+	CL_ESC,
+	CL_BEL, // ends an OSC string
+	CL_INTER, // intermediate bytes 0x20-0x2f
+	CL_DIGIT,
+	CL_COLON,
+	CL_SEMI,
+	CL_PRIV, // private parameter markers < = > ?
+	CL_FINAL, // 0x40-0x7e except for the ones below
+	CL_DCS, // P
+	CL_CSI, // [
+	CL_OSC, // ]
+	CL_STR, // X ^ _ start SOS, PM and APC strings
+	CL_DEL,
+	CL_HIGH,
+	CL_COUNT
+};
+
+static const uint8_t _vt100_class[128] PROGMEM = {
+	// 0x00: C0 controls
+	CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL, CL_BEL,
+	CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL,
+	CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL,
+	CL_CAN, CL_CTRL, CL_CAN, CL_ESC, CL_CTRL, CL_CTRL, CL_CTRL, CL_CTRL,
+	// 0x20: space and intermediates
+	CL_INTER, CL_INTER, CL_INTER, CL_INTER, CL_INTER, CL_INTER, CL_INTER, CL_INTER,
+	CL_INTER, CL_INTER, CL_INTER, CL_INTER, CL_INTER, CL_INTER, CL_INTER, CL_INTER,
+	// 0x30: parameters
+	CL_DIGIT, CL_DIGIT, CL_DIGIT, CL_DIGIT, CL_DIGIT, CL_DIGIT, CL_DIGIT, CL_DIGIT,
+	CL_DIGIT, CL_DIGIT, CL_COLON, CL_SEMI, CL_PRIV, CL_PRIV, CL_PRIV, CL_PRIV,
+	// 0x40: final bytes
+	CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL,
+	CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL,
+	CL_DCS, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL,
+	CL_STR, CL_FINAL, CL_FINAL, CL_CSI, CL_FINAL, CL_OSC, CL_STR, CL_STR,
+	CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL,
+	CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL,
+	CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL,
+	CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_FINAL, CL_DEL
+};
+
+// parser actions, done on the transition
+enum {
+	AC_NONE,
+	AC_PRINT,
+	AC_EXECUTE, // C0 control
+	AC_CLEAR, // start of a sequence: forget parameters and intermediates
+	AC_COLLECT, // intermediate or private marker
+	AC_PARAM, // digit or separator
+	AC_ESC_DISPATCH,
+	AC_CSI_DISPATCH
+};
+
+#define TR(action, state) (((action) << 4) | (state))
+
+// next state and action for every state and byte class
+static const uint8_t _vt100_transitions[][CL_COUNT] PROGMEM = {
+	[ST_GROUND] = {
+		TR(AC_EXECUTE, ST_GROUND), TR(AC_EXECUTE, ST_GROUND),
+		TR(AC_CLEAR, ST_ESCAPE), TR(AC_EXECUTE, ST_GROUND),
+		TR(AC_PRINT, ST_GROUND), TR(AC_PRINT, ST_GROUND),
+		TR(AC_PRINT, ST_GROUND), TR(AC_PRINT, ST_GROUND),
+		TR(AC_PRINT, ST_GROUND), TR(AC_PRINT, ST_GROUND),
+		TR(AC_PRINT, ST_GROUND), TR(AC_PRINT, ST_GROUND),
+		TR(AC_PRINT, ST_GROUND), TR(AC_PRINT, ST_GROUND),
+		TR(AC_EXECUTE, ST_GROUND), TR(AC_PRINT, ST_GROUND)
+	},
+	[ST_ESCAPE] = {
+		TR(AC_EXECUTE, ST_ESCAPE), TR(AC_NONE, ST_GROUND),
+		TR(AC_CLEAR, ST_ESCAPE), TR(AC_EXECUTE, ST_ESCAPE),
+		TR(AC_COLLECT, ST_ESC_INTER), TR(AC_ESC_DISPATCH, ST_GROUND),
+		TR(AC_ESC_DISPATCH, ST_GROUND), TR(AC_ESC_DISPATCH, ST_GROUND),
+		TR(AC_ESC_DISPATCH, ST_GROUND), TR(AC_ESC_DISPATCH, ST_GROUND),
+		TR(AC_NONE, ST_DCS), TR(AC_NONE, ST_CSI_ENTRY),
+		TR(AC_NONE, ST_OSC), TR(AC_NONE, ST_OSC),
+		TR(AC_NONE, ST_ESCAPE), TR(AC_NONE, ST_GROUND)
+	},
+	[ST_ESC_INTER] = {
+		TR(AC_EXECUTE, ST_ESC_INTER), TR(AC_NONE, ST_GROUND),
+		TR(AC_CLEAR, ST_ESCAPE), TR(AC_EXECUTE, ST_ESC_INTER),
+		TR(AC_COLLECT, ST_ESC_INTER), TR(AC_ESC_DISPATCH, ST_GROUND),
+		TR(AC_ESC_DISPATCH, ST_GROUND), TR(AC_ESC_DISPATCH, ST_GROUND),
+		TR(AC_ESC_DISPATCH, ST_GROUND), TR(AC_ESC_DISPATCH, ST_GROUND),
+		TR(AC_ESC_DISPATCH, ST_GROUND), TR(AC_ESC_DISPATCH, ST_GROUND),
+		TR(AC_ESC_DISPATCH, ST_GROUND), TR(AC_ESC_DISPATCH, ST_GROUND),
+		TR(AC_NONE, ST_ESC_INTER), TR(AC_NONE, ST_GROUND)
+	},
+	[ST_CSI_ENTRY] = {
+		TR(AC_EXECUTE, ST_CSI_ENTRY), TR(AC_NONE, ST_GROUND),
+		TR(AC_CLEAR, ST_ESCAPE), TR(AC_EXECUTE, ST_CSI_ENTRY),
+		TR(AC_COLLECT, ST_CSI_INTER), TR(AC_PARAM, ST_CSI_PARAM),
+		TR(AC_NONE, ST_CSI_IGNORE), TR(AC_PARAM, ST_CSI_PARAM),
+		TR(AC_COLLECT, ST_CSI_PARAM), TR(AC_CSI_DISPATCH, ST_GROUND),
+		TR(AC_CSI_DISPATCH, ST_GROUND), TR(AC_CSI_DISPATCH, ST_GROUND),
+		TR(AC_CSI_DISPATCH, ST_GROUND), TR(AC_CSI_DISPATCH, ST_GROUND),
+		TR(AC_NONE, ST_CSI_ENTRY), TR(AC_NONE, ST_GROUND)
+	},
+	[ST_CSI_PARAM] = {
+		TR(AC_EXECUTE, ST_CSI_PARAM), TR(AC_NONE, ST_GROUND),
+		TR(AC_CLEAR, ST_ESCAPE), TR(AC_EXECUTE, ST_CSI_PARAM),
+		TR(AC_COLLECT, ST_CSI_INTER), TR(AC_PARAM, ST_CSI_PARAM),
+		TR(AC_NONE, ST_CSI_IGNORE), TR(AC_PARAM, ST_CSI_PARAM),
+		TR(AC_NONE, ST_CSI_IGNORE), TR(AC_CSI_DISPATCH, ST_GROUND),
+		TR(AC_CSI_DISPATCH, ST_GROUND), TR(AC_CSI_DISPATCH, ST_GROUND),
+		TR(AC_CSI_DISPATCH, ST_GROUND), TR(AC_CSI_DISPATCH, ST_GROUND),
+		TR(AC_NONE, ST_CSI_PARAM), TR(AC_NONE, ST_GROUND)
+	},
+	[ST_CSI_INTER] = {
+		TR(AC_EXECUTE, ST_CSI_INTER), TR(AC_NONE, ST_GROUND),
+		TR(AC_CLEAR, ST_ESCAPE), TR(AC_EXECUTE, ST_CSI_INTER),
+		TR(AC_COLLECT, ST_CSI_INTER), TR(AC_NONE, ST_CSI_IGNORE),
+		TR(AC_NONE, ST_CSI_IGNORE), TR(AC_NONE, ST_CSI_IGNORE),
+		TR(AC_NONE, ST_CSI_IGNORE), TR(AC_CSI_DISPATCH, ST_GROUND),
+		TR(AC_CSI_DISPATCH, ST_GROUND), TR(AC_CSI_DISPATCH, ST_GROUND),
+		TR(AC_CSI_DISPATCH, ST_GROUND), TR(AC_CSI_DISPATCH, ST_GROUND),
+		TR(AC_NONE, ST_CSI_INTER), TR(AC_NONE, ST_GROUND)
+	},
+	[ST_CSI_IGNORE] = {
+		TR(AC_EXECUTE, ST_CSI_IGNORE), TR(AC_NONE, ST_GROUND),
+		TR(AC_CLEAR, ST_ESCAPE), TR(AC_EXECUTE, ST_CSI_IGNORE),
+		TR(AC_NONE, ST_CSI_IGNORE), TR(AC_NONE, ST_CSI_IGNORE),
+		TR(AC_NONE, ST_CSI_IGNORE), TR(AC_NONE, ST_CSI_IGNORE),
+		TR(AC_NONE, ST_CSI_IGNORE), TR(AC_NONE, ST_GROUND),
+		TR(AC_NONE, ST_GROUND), TR(AC_NONE, ST_GROUND),
+		TR(AC_NONE, ST_GROUND), TR(AC_NONE, ST_GROUND),
+		TR(AC_NONE, ST_CSI_IGNORE), TR(AC_NONE, ST_GROUND)
+	},
+	[ST_DCS] = {
+		TR(AC_NONE, ST_DCS), TR(AC_NONE, ST_GROUND),
+		TR(AC_CLEAR, ST_ESCAPE), TR(AC_NONE, ST_DCS),
+		TR(AC_NONE, ST_DCS), TR(AC_NONE, ST_DCS),
+		TR(AC_NONE, ST_DCS), TR(AC_NONE, ST_DCS),
+		TR(AC_NONE, ST_DCS), TR(AC_NONE, ST_DCS),
+		TR(AC_NONE, ST_DCS), TR(AC_NONE, ST_DCS),
+		TR(AC_NONE, ST_DCS), TR(AC_NONE, ST_DCS),
+		TR(AC_NONE, ST_DCS), TR(AC_NONE, ST_DCS)
+	},
+	[ST_OSC] = {
+		TR(AC_NONE, ST_OSC), TR(AC_NONE, ST_GROUND),
+		TR(AC_CLEAR, ST_ESCAPE), TR(AC_NONE, ST_GROUND),
+		TR(AC_NONE, ST_OSC), TR(AC_NONE, ST_OSC),
+		TR(AC_NONE, ST_OSC), TR(AC_NONE, ST_OSC),
+		TR(AC_NONE, ST_OSC), TR(AC_NONE, ST_OSC),
+		TR(AC_NONE, ST_OSC), TR(AC_NONE, ST_OSC),
+		TR(AC_NONE, ST_OSC), TR(AC_NONE, ST_OSC),
+		TR(AC_NONE, ST_OSC), TR(AC_NONE, ST_OSC)
+	}
+};
+
+#undef TR
+
+// number of lines, columns or characters for a command (default 1)
+static inline uint16_t _vt100_count(struct vt100 *t){
+	return t->args[0]?t->args[0]:1;
+}
+
+// ESC [ n A: cursor up (cursor stops at top margin)
+static void _csi_cuu(struct vt100 *t){
+	t->cursor_y -= _vt100_count(t);
+	if(t->cursor_y < 0) t->cursor_y = 0;
+	_vt100_trackRow(t);
+}
+
+// ESC [ n B: cursor down (cursor stops at bottom margin)
+static void _csi_cud(struct vt100 *t){
+	t->cursor_y += _vt100_count(t);
+	if(t->cursor_y > VT100_ROWS(t)) t->cursor_y = VT100_ROWS(t);
+	_vt100_trackRow(t);
+}
+
+// ESC [ n C: cursor right (cursor stops at right margin)
+static void _csi_cuf(struct vt100 *t){
+	t->cursor_x += _vt100_count(t);
+	if(t->cursor_x > VT100_COLS(t)) t->cursor_x = VT100_COLS(t);
+}
+
+// ESC [ n D: cursor left
+static void _csi_cub(struct vt100 *t){
+	t->cursor_x -= _vt100_count(t);
+	if(t->cursor_x < 0) t->cursor_x = 0;
+}
+
+// ESC [ row ; col H and f: move cursor to position (default 1;1). The cursor
+// stops at the respective margins
+static void _csi_cup(struct vt100 *t){
+	t->cursor_x = t->args[1]?(t->args[1] - 1):0;
+	t->cursor_y = t->args[0]?(t->args[0] - 1):0;
+	if(t->flags.origin_mode) {
+		t->cursor_y += t->scroll_start_row;
+		if(t->cursor_y >= t->scroll_end_row){
+			t->cursor_y = t->scroll_end_row - 1;
 		}
 	}
+	if(t->cursor_x > VT100_COLS(t)) t->cursor_x = VT100_COLS(t);
+	if(t->cursor_y > VT100_ROWS(t)) t->cursor_y = VT100_ROWS(t);
+	_vt100_trackRow(t);
 }
 
-STATE(_st_escape, term, ev, arg){
-	switch(ev){
-		case EV_CHAR: {
-			#define CLEAR_ARGS \
-				{ term->narg = 0;\
-				for(int c = 0; c < MAX_COMMAND_ARGS; c++)\
-					term->args[c] = 0; }\
-			
-			switch(arg){
-				case '[': { // command
-					// prepare command state and switch to it
-					CLEAR_ARGS; 
-					term->state = _st_esc_sq_bracket;
-					break;
-				}
-				case '(': /* ESC ( */  
-					CLEAR_ARGS;
-					term->state = _st_esc_left_br;
-					break; 
-				case ')': /* ESC ) */  
-					CLEAR_ARGS;
-					term->state = _st_esc_right_br;
-					break;  
-				case '#': // ESC # 
-					CLEAR_ARGS;
-					term->state = _st_esc_hash;
-					break;  
-				case 'P': //ESC P (DCS, Device Control String)
-					term->state = _st_idle; 
-					break;
-				case 'D': // moves cursor down one line and scrolls if necessary
-					// move cursor down one line and scroll window if at bottom line
-					_vt100_move(term, 0, 1); 
-					term->state = _st_idle;
-					break; 
-				case 'M': // Cursor up
-					// move cursor up one line and scroll window if at top line
-					_vt100_move(term, 0, -1); 
-					term->state = _st_idle;
-					break; 
-				case 'E': // next line
-					// same as '\r\n'
-					_vt100_move(term, 0, 1);
-					term->cursor_x = 0; 
-					term->state = _st_idle;
-					break;  
-				case '7': // Save attributes and cursor position  
-				case 's':  
-					term->saved_cursor_x = term->cursor_x;
-					term->saved_cursor_y = term->cursor_y;
-					term->state = _st_idle;
-					break;  
-				case '8': // Restore them  
-				case 'u': 
-					term->cursor_x = term->saved_cursor_x;
-					term->cursor_y = term->saved_cursor_y; 
-					term->state = _st_idle;
-					break; 
-				case '=': // Keypad into applications mode 
-					term->state = _st_idle;
-					break; 
-				case '>': // Keypad into numeric mode   
-					term->state = _st_idle;
-					break;  
-				case 'Z': // Report terminal type 
-					// vt 100 response
-					term->send_response("\033[?1;0c");  
-					// unknown terminal     
-						//out("\033[?c");
-					term->state = _st_idle;
-					break;    
-				case 'c': // Reset terminal to initial state 
-					_vt100_reset();
-					term->state = _st_idle;
-					break;  
-				case 'H': // Set tab in current position 
-				case 'N': // G2 character set for next character only  
-				case 'O': // G3 "               "     
-				case '<': // Exit vt52 mode
-					// ignore
-					term->state = _st_idle;
-					break; 
-				case KEY_ESC: { // marks start of next escape sequence
-					// stay in escape state
-					break;
-				}
-				default: { // unknown sequence - return to normal mode
-					term->state = _st_idle;
-					break;
-				}
-			}
-			#undef CLEAR_ARGS
+// ESC [ n J: clear screen from cursor down (0), up (1) or all of it (2)
+static void _csi_ed(struct vt100 *t){
+	switch(t->args[0]){
+		case 0: // down to the bottom of screen (including cursor)
+			_vt100_clearLines(t, t->cursor_y, VT100_ROWS(t));
 			break;
+		case 1: // top of screen to current line (including cursor)
+			_vt100_clearLines(t, 0, t->cursor_y);
+			break;
+		case 2: // whole screen, and reset the scroll value
+			_vt100_clearLines(t, 0, VT100_ROWS(t));
+			_vt100_resetScroll(t);
+			break;
+	}
+}
+
+// ESC [ n K: clear line from cursor right (0), left (1) or all of it (2). The
+// cells are erased in the current background color and drawn by the next
+// flush
+static void _csi_el(struct vt100 *t){
+	uint16_t width = VT100_COLS(t);
+	uint16_t col = (t->cursor_x < width)?t->cursor_x:width;
+	uint16_t phys = t->cursor_phys;
+	if(t->cursor_y >= VT100_ROWS(t)) return; // below the last line
+	switch(t->args[0]){
+		case 0: // to end of line, including cursor
+			_vt100_eraseCells(t, phys, col, width - col);
+			break;
+		case 1: // from left to current cursor position
+			_vt100_eraseCells(t, phys, 0, (col < width)?col + 1:width);
+			break;
+		case 2: // whole current line
+			_vt100_eraseCells(t, phys, 0, width);
+			break;
+	}
+}
+
+// ESC [ n L: insert lines
+static void _csi_il(struct vt100 *t){
+	_vt100_shiftLines(t, -(int16_t)_vt100_count(t));
+}
+
+// ESC [ n M: delete lines
+static void _csi_dl(struct vt100 *t){
+	_vt100_shiftLines(t, _vt100_count(t));
+}
+
+// ESC [ n P: delete characters at the cursor
+static void _csi_dch(struct vt100 *t){
+	_vt100_shiftChars(t, _vt100_count(t));
+}
+
+// ESC [ n @: insert blank characters at the cursor
+static void _csi_ich(struct vt100 *t){
+	_vt100_shiftChars(t, -(int16_t)_vt100_count(t));
+}
+
+// ESC [ c: query device code
+static void _csi_da(struct vt100 *t){
+	t->send_response("\e[?1;0c");
+}
+
+// ESC [ s: save cursor position
+static void _csi_scp(struct vt100 *t){
+	t->saved_cursor_x = t->cursor_x;
+	t->saved_cursor_y = t->cursor_y;
+}
+
+// ESC [ u: restore cursor position
+static void _csi_rcp(struct vt100 *t){
+	t->cursor_x = t->saved_cursor_x;
+	t->cursor_y = t->saved_cursor_y;
+	_vt100_trackRow(t);
+}
+
+// ESC [ n ; ... m: sets colors. ESC [ m resets them to the default
+static void _csi_sgr(struct vt100 *t){
+	if(!t->narg) t->narg = 1;
+	for(uint8_t i = 0; i < t->narg; i++){
+		uint16_t n = t->args[i];
+		if(n == 0){ // all attributes off
+			t->front_color = 0xffff;
+			t->back_color = 0x0000;
+			t->attr = VT100_DEFAULT_ATTR;
+
+			ili9340_setFrontColor(t->front_color);
+			ili9340_setBackColor(t->back_color);
+		} else if(n >= 30 && n < 38){ // fg colors
+			t->front_color = pgm_read_word(&_vt100_colors[n-30]);
+			t->attr = (t->attr & 0x38) | (n - 30);
+			ili9340_setFrontColor(t->front_color);
+		} else if(n >= 40 && n < 48){
+			t->back_color = pgm_read_word(&_vt100_colors[n-40]);
+			t->attr = (t->attr & 0x07) | ((n - 40) << 3);
+			ili9340_setBackColor(t->back_color);
 		}
-		default: {
-			// for all other events restore normal mode
-			term->state = _st_idle; 
+	}
+}
+
+// ESC [ top ; bottom r: set scroll region (top and bottom margins). Top and
+// bottom are the first and the last row of the scroll region (1 based)
+static void _csi_decstbm(struct vt100 *t){
+	// a missing or 0 top means the first row, and a missing bottom or one
+	// below the screen the last row of the screen
+	int16_t top = t->args[0]?t->args[0] - 1:0;
+	int16_t end = VT100_ROWS(t);
+	if(t->narg >= 2 && t->args[1] && t->args[1] < end) end = t->args[1];
+	if(top >= end){
+		_vt100_resetScroll(t);
+		return;
+	}
+	if(top == t->scroll_start_row && end == t->scroll_end_row) return;
+	_vt100_unscroll(t);
+	// [2;39r means a scroll region between pixel lines 8 and 312: the top
+	// margin is (2 - 1) * 8 and the bottom margin 320 - 39 * 8 = 8 pixels
+	t->scroll_start_row = top;
+	t->scroll_end_row = end;
+	if(VT100_HW_SCROLL(t)){
+		uint16_t top_margin = t->scroll_start_row * VT100_CHAR_HEIGHT;
+		uint16_t bottom_margin = VT100_SCREEN_HEIGHT -
+			(t->scroll_end_row * VT100_CHAR_HEIGHT);
+		ili9340_setScrollMargins(top_margin, bottom_margin);
+		// the scroll start was counted from the old top
+		t->scroll_pending = 1;
+	}
+	_vt100_trackRow(t);
+}
+
+// ESC [ ? n ; ... h and l: DEC private modes ON (set) and OFF
+static void _vt100_decMode(struct vt100 *t, uint8_t set){
+	for(uint8_t i = 0; i < t->narg; i++){
+		switch(t->args[i]){
+			// 1 cursor keys, 2 ansi / vt52, 3 132 / 80 chars per line,
+			// 4 smooth / jump scroll, 5 reverse screen: not supported
+			case 6: // cursor relative to scroll region / independent of it
+				t->flags.origin_mode = set;
+				break;
+			case 7: // new line after last column / cursor stays at the end
+				t->flags.cursor_wrap = set;
+				break;
+			// 8 auto repeat, 9 interlace and 10-38 (quite DEC specific)
+			// are not supported either
 		}
 	}
 }
 
-STATE(_st_idle, term, ev, arg){
-	switch(ev){
-		case EV_CHAR: {
-			switch(arg){
-				
-				case 5: // AnswerBack for vt100's  
-					term->send_response("X"); // should send SCCS_ID?
-					break;  
-				case '\n': { // new line
-					_vt100_move(term, 0, 1);
-					term->cursor_x = 0; 
-					//_vt100_moveCursor(term, 0, term->cursor_y + 1);
-					// do scrolling here! 
-					break;
-				}
-				case '\r': { // carrage return (0x0d)
-					term->cursor_x = 0; 
-					//_vt100_move(term, 0, 1);
-					//_vt100_moveCursor(term, 0, term->cursor_y); 
-					break;
-				}
-				case '\b': { // backspace 0x08
-					_vt100_move(term, -1, 0); 
-					// backspace does not delete the character! Only moves cursor!
-					//ili9340_drawChar(term->cursor_x * term->char_width,
-					//	term->cursor_y * term->char_height, ' ');
-					break;
-				}
-				case KEY_DEL: { // del - delete character under cursor
-					// Problem: with current implementation, we can't move the rest of line
-					// to the left as is the proper behavior of the delete character
-					// fill the current position with background color
-					_vt100_putc(term, ' ');
-					_vt100_move(term, -1, 0);
-					//_vt100_clearChar(term, term->cursor_x, term->cursor_y); 
-					break;
-				}
-				case '\t': { // tab
-					// tab fills characters on the line until we reach a multiple of tab_stop
-					int tab_stop = 4;
-					int to_put = tab_stop - (term->cursor_x % tab_stop); 
-					while(to_put--) _vt100_putc(term, ' ');
-					break;
-				}
-				case KEY_BELL: { // bell is sent by bash for ex. when doing tab completion
-					// sound the speaker bell?
-					// skip
-					break; 
-				}
-				case KEY_ESC: {// escape
-					term->state = _st_escape;
-					break;
-				}
-				default: {
-					_vt100_putc(term, arg);
-					break;
-				}
+typedef void (*vt100_handler_t)(struct vt100 *t);
+
+// control sequence handlers by final byte, from 0x40 (@) to 0x7e (~)
+static const vt100_handler_t _vt100_csi[] PROGMEM = {
+	['@' - 0x40] = _csi_ich,
+	['A' - 0x40] = _csi_cuu,
+	['B' - 0x40] = _csi_cud,
+	['C' - 0x40] = _csi_cuf,
+	['D' - 0x40] = _csi_cub,
+	['H' - 0x40] = _csi_cup,
+	['J' - 0x40] = _csi_ed,
+	['K' - 0x40] = _csi_el,
+	['L' - 0x40] = _csi_il,
+	['M' - 0x40] = _csi_dl,
+	['P' - 0x40] = _csi_dch,
+	['c' - 0x40] = _csi_da,
+	['f' - 0x40] = _csi_cup,
+	['m' - 0x40] = _csi_sgr,
+	['r' - 0x40] = _csi_decstbm,
+	['s' - 0x40] = _csi_scp,
+	['u' - 0x40] = _csi_rcp,
+	['~' - 0x40] = 0
+};
+
+// ESC D: move cursor down one line and scroll window if at bottom line
+static void _esc_ind(struct vt100 *t){
+	_vt100_move(t, 0, 1);
+}
+
+// ESC M: move cursor up one line and scroll window if at top line
+static void _esc_ri(struct vt100 *t){
+	_vt100_move(t, 0, -1);
+}
+
+// ESC E: next line, same as '\r\n'
+static void _esc_nel(struct vt100 *t){
+	_vt100_move(t, 0, 1);
+	t->cursor_x = 0;
+}
+
+// ESC Z: report terminal type (vt 100)
+static void _esc_decid(struct vt100 *t){
+	t->send_response("\033[?1;0c");
+}
+
+// ESC c: reset terminal to initial state
+static void _esc_ris(struct vt100 *t){
+	_vt100_reset(t);
+}
+
+// escape sequence handlers by final byte, from 0x30 (0) to 0x7e (~). Keypad
+// modes (= and >), tab stops (H), single shifts (N and O) and vt52 mode (<)
+// are ignored
+static const vt100_handler_t _vt100_esc[] PROGMEM = {
+	['7' - 0x30] = _csi_scp, // save attributes and cursor position
+	['8' - 0x30] = _csi_rcp, // restore them
+	['D' - 0x30] = _esc_ind,
+	['E' - 0x30] = _esc_nel,
+	['M' - 0x30] = _esc_ri,
+	['Z' - 0x30] = _esc_decid,
+	['c' - 0x30] = _esc_ris,
+	['s' - 0x30] = _csi_scp,
+	['u' - 0x30] = _csi_rcp,
+	['~' - 0x30] = 0
+};
+
+// C0 controls
+static void _vt100_execute(struct vt100 *t, uint8_t ch){
+	switch(ch){
+		case 5: // AnswerBack for vt100's
+			t->send_response("X"); // should send SCCS_ID?
+			break;
+		case '\n': // new line
+			_vt100_move(t, 0, 1);
+			t->cursor_x = 0;
+			break;
+		case '\r': // carrage return (0x0d)
+			t->cursor_x = 0;
+			break;
+		case '\b': // backspace 0x08, only moves the cursor
+			_vt100_move(t, -1, 0);
+			break;
+		case KEY_DEL: // del - delete character under cursor
+			// the rest of the line moves to the left
+			_vt100_shiftChars(t, 1);
+			break;
+		case '\t': { // tab
+			// tab fills characters on the line until we reach a multiple of tab_stop
+			int tab_stop = 4;
+			int to_put = tab_stop - (t->cursor_x & (tab_stop - 1));
+			if(_vt100_mustDrawText(t, to_put)) break;
+			while(to_put--) _vt100_putc(t, ' ');
+			break;
+		}
+		case KEY_BELL: // bell is sent by bash for ex. when doing tab completion
+			break;
+		default: // shown as a hex code
+			_vt100_putc(t, ch);
+			break;
+	}
+}
+
+static void _vt100_escDispatch(struct vt100 *t, uint8_t ch){
+	// character set selection (ESC ( and ESC )) and ESC # are ignored
+	if(t->inter) return;
+	vt100_handler_t handler = (vt100_handler_t)pgm_read_ptr(&_vt100_esc[ch - 0x30]);
+	if(handler) handler(t);
+}
+
+static void _vt100_csiDispatch(struct vt100 *t, uint8_t ch){
+	if(t->narg > MAX_COMMAND_ARGS) t->narg = MAX_COMMAND_ARGS;
+	if(t->inter == '?'){
+		if(ch == 'h' || ch == 'l') _vt100_decMode(t, ch == 'h');
+		return;
+	}
+	// no sequences with intermediates or other private markers are supported
+	if(t->inter) return;
+	vt100_handler_t handler = (vt100_handler_t)pgm_read_ptr(&_vt100_csi[ch - 0x40]);
+	if(handler) handler(t);
+}
+
+// feeds one byte through the parser: a class lookup and a transition lookup,
+// then the action of the transition. Returns 0 when the action has to wait
+// for a row to be drawn, with the parser left as it was before the byte
+static uint8_t _vt100_parse(struct vt100 *t, uint8_t ch){
+	uint8_t cls = (ch & 0x80)?CL_HIGH:pgm_read_byte(&_vt100_class[ch]);
+	uint8_t tr = pgm_read_byte(&_vt100_transitions[t->state][cls]);
+	uint8_t state = t->state;
+	t->flags.wait = 0;
+	// the state is set first, so that an action can change it (ESC c)
+	t->state = tr & 0x0f;
+	switch(tr >> 4){
+		case AC_PRINT:
+			_vt100_putc(t, ch);
+			break;
+		case AC_EXECUTE:
+			_vt100_execute(t, ch);
+			break;
+		case AC_CLEAR:
+			t->inter = 0;
+			t->narg = 0;
+			memset(t->args, 0, sizeof(t->args));
+			break;
+		case AC_COLLECT:
+			// only one intermediate or marker is kept, more make it invalid
+			t->inter = t->inter?0xff:ch;
+			break;
+		case AC_PARAM: {
+			// narg is the number of parameters started, the ones past
+			// MAX_COMMAND_ARGS are dropped
+			if(!t->narg) t->narg = 1;
+			if(ch == ';'){
+				if(t->narg <= MAX_COMMAND_ARGS) t->narg++;
+			} else if(t->narg <= MAX_COMMAND_ARGS){
+				uint16_t *arg = &t->args[t->narg - 1];
+				if(*arg < 1000) *arg = *arg * 10 + (ch - '0');
 			}
 			break;
 		}
-		default: {}
+		case AC_ESC_DISPATCH:
+			_vt100_escDispatch(t, ch);
+			break;
+		case AC_CSI_DISPATCH:
+			_vt100_csiDispatch(t, ch);
+			break;
 	}
+	if(t->flags.wait){
+		t->state = state;
+		return 0;
+	}
+	return 1;
+}
+
+// sets up terminal t in the viewport of w x h pixels at (x, y). The size in
+// characters is rounded down
+static void _vt100_open(struct vt100 *t, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+	void (*send_response)(char *str)){
+#if VT100_INSTANCES > 1
+	t->left = x;
+	t->top = y;
+	t->view_width = w;
+	t->cols = w / VT100_CHAR_WIDTH;
+	t->rows = h / VT100_CHAR_HEIGHT;
+	t->flags.fullscreen = !x && !y && w == VT100_SCREEN_WIDTH && h == VT100_SCREEN_HEIGHT;
+#else
+	(void)x; (void)y; (void)w; (void)h;
+#endif
+	t->flags.open = 1;
+	t->send_response = send_response;
+	_vt100_reset(t);
+}
+
+vt100_t *vt100_init(void (*send_response)(char *str)){
+#if VT100_INSTANCES > 1
+	// the first terminal can be a pane that was opened first, which is left
+	// to its owner
+	if(_vt100_terms[0].flags.open && !VT100_FULLSCREEN(&_vt100_terms[0])) return 0;
+#endif
+#ifdef VT100_ROTATION
+	ili9340_setRotation(VT100_ROTATION);
+#endif
+	_vt100_open(&_vt100_terms[0], 0, 0, VT100_SCREEN_WIDTH, VT100_SCREEN_HEIGHT, send_response);
+	return &_vt100_terms[0];
+}
+
+#if VT100_INSTANCES > 1
+vt100_t *vt100_open(uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+	void (*send_response)(char *str)){
+	if(w < VT100_CHAR_WIDTH || h < VT100_CHAR_HEIGHT ||
+		x + w > VT100_SCREEN_WIDTH || y + h > VT100_SCREEN_HEIGHT) return 0;
+#ifdef VT100_ROTATION
+	// vt100_init may not have run when there are only panes
+	ili9340_setRotation(VT100_ROTATION);
+#endif
+	for(uint8_t i = 0; i < VT100_INSTANCES; i++){
+		struct vt100 *t = &_vt100_terms[i];
+		if(t->flags.open) continue;
+		_vt100_open(t, x, y, w, h, send_response);
+		return t;
+	}
+	return 0;
+}
+
+void vt100_close(vt100_t *t){
+	if(!t->flags.open) return;
+	// the display's scroll area goes back to normal for the panes that may
+	// be opened in its place. The rows are first put back where they show
+	// and drawn there, so the picture does not move
+	if(VT100_FULLSCREEN(t)){
+		_vt100_unscroll(t);
+		vt100_term_flush(t, VT100_FLUSH_ALL);
+		ili9340_setScrollMargins(0, 0);
+		ili9340_setScrollStart(0);
+	}
+	t->flags.open = 0;
+	// nothing left for vt100_flush_all to draw or count
+	t->dirty_rows = 0;
+	t->scroll_pending = 0;
+}
+#endif
+
+#ifndef VT100_ROTATION
+uint8_t vt100_width(void){
+	return VT100_COLS(&_vt100_terms[0]);
+}
+
+uint8_t vt100_height(void){
+	return VT100_ROWS(&_vt100_terms[0]);
+}
+#endif
+
+// printable characters that can be drawn directly from the ground state
+#define VT100_IS_PRINTABLE(ch) ((ch) >= 0x20 && (ch) <= 0x7e)
+
+size_t vt100_term_write(vt100_t *t, const uint8_t *buf, size_t len){
+	size_t total = len;
+	while(len){
+		if(t->state == ST_GROUND && VT100_IS_PRINTABLE(*buf)){
+			// plain text: render everything up to the next control byte at once
+			size_t n = 1;
+			while(n < len && VT100_IS_PRINTABLE(buf[n]) && n < 0xffff) n++;
+			t->flags.wait = 0;
+			uint16_t done = _vt100_putRun(t, buf, n);
+			buf += done;
+			len -= done;
+			if(done < n) break;
+		} else {
+			if(!_vt100_parse(t, *buf)) break;
+			buf++;
+			len--;
+		}
+	}
+	return total - len;
+}
+
+size_t vt100_write(const uint8_t *buf, size_t len){
+	return vt100_term_write(&_vt100_terms[0], buf, len);
 }
 
-void vt100_init(void (*send_response)(char *str)){
-  term.send_response = send_response; 
-	_vt100_reset(); 
+void vt100_term_putc(vt100_t *t, uint8_t c){
+	_vt100_writeAll(t, &c, 1);
+	vt100_term_flush(t, VT100_FLUSH_ALL);
 }
 
 void vt100_putc(uint8_t c){
@@ -874,10 +1823,10 @@ void vt100_putc(uint8_t c){
 	}
 	if(buffer){
 		while(*buffer){
-			term.state(&term, EV_CHAR, *buffer++);
+			_vt100_parse(&term, *buffer++);
 		}
 	} else {
-		term.state(&term, EV_CHAR, 0x0000 | c);
+		_vt100_parse(&term, c);
 	}*/
-	term.state(&term, EV_CHAR, 0x0000 | c);
+	vt100_term_putc(&_vt100_terms[0], c);
 }
@@ -19,20 +19,109 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ili9340.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define VT100_SCREEN_WIDTH ili9340_width()
-#define VT100_SCREEN_HEIGHT ili9340_height()
 #define VT100_CHAR_WIDTH 6
 #define VT100_CHAR_HEIGHT 8
+
+// Building with -DVT100_ROTATION=n (0-3) fixes the display rotation at
+// compile time: vt100_init sets it, and the screen and terminal size are
+// constants. Otherwise they follow the rotation the display has when
+// vt100_init (or ESC c) runs, and the terminal size is kept in variables
+#ifdef VT100_ROTATION
+#if VT100_ROTATION & 1
+#define VT100_SCREEN_WIDTH ILI9340_TFTHEIGHT
+#define VT100_SCREEN_HEIGHT ILI9340_TFTWIDTH
+#else
+#define VT100_SCREEN_WIDTH ILI9340_TFTWIDTH
+#define VT100_SCREEN_HEIGHT ILI9340_TFTHEIGHT
+#endif
 #define VT100_HEIGHT (VT100_SCREEN_HEIGHT / VT100_CHAR_HEIGHT)
 #define VT100_WIDTH (VT100_SCREEN_WIDTH / VT100_CHAR_WIDTH)
+#else
+#define VT100_SCREEN_WIDTH ili9340_width()
+#define VT100_SCREEN_HEIGHT ili9340_height()
+#define VT100_HEIGHT vt100_height()
+#define VT100_WIDTH vt100_width()
+// terminal size in characters
+uint8_t vt100_width(void);
+uint8_t vt100_height(void);
+#endif
 
-void vt100_init(void (*send_response)(char *str)); 
+#define VT100_FLUSH_ALL 0xff
+
+// Build with -DVT100_INSTANCES=n to have room for n terminals on the display
+// (each has its own cell grid, so that takes a part with more ram). The first
+// one is the default terminal: vt100_init sets it up over the whole display,
+// and the functions without a terminal argument work on it. With only panes
+// vt100_init is not needed, the first pane opened is the default terminal
+#ifndef VT100_INSTANCES
+#define VT100_INSTANCES 1
+#endif
+
+typedef struct vt100 vt100_t;
+
+// sets up the default terminal over the whole display (again, if it was
+// set up before) and returns it. With VT100_INSTANCES > 1 it returns 0 when
+// the first terminal is taken by a pane
+vt100_t *vt100_init(void (*send_response)(char *str)); 
+// putc and puts update the display before they return
 void vt100_putc(uint8_t ch);
 void vt100_puts(const char *str);
+// same as vt100_puts for a string stored in program memory (PSTR)
+void vt100_puts_P(const char *str);
+// feeds a buffer of received bytes to the terminal. Only the terminal's copy
+// of the screen is updated, the changed parts are drawn by vt100_flush. That
+// way a burst of output costs one draw per changed cell no matter how often
+// the cell was written. Returns the number of bytes taken: with the single
+// byte cells of the 2 KB parts a byte that changes the colors of a row can
+// have to wait until what is pending on the row is drawn, then the rest is
+// passed again after a vt100_flush
+size_t vt100_write(const uint8_t *buf, size_t len);
+// draws what changed since the last flush, one address window per color.
+// The work is done in steps of at most half a row of pixels (cleared or
+// drawn) and at most max_steps of them are done per call (VT100_FLUSH_ALL
+// for everything), so vt100_flush(1) never keeps the caller away from the
+// uart for long. Returns the number of rows still waiting to be drawn
+uint8_t vt100_flush(uint8_t max_steps);
+
+#if VT100_INSTANCES > 1
+// sets up another terminal in the viewport of w x h pixels at (x, y), or
+// returns 0 when all VT100_INSTANCES are in use. Only a terminal that covers
+// the whole display in portrait scrolls in hardware, the display has one
+// scroll area along its long side. Others (panes) scroll by redrawing lines
+vt100_t *vt100_open(uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+	void (*send_response)(char *str));
+// frees terminal t for vt100_open. What it drew stays on the display; closing
+// the terminal that covers the whole display also unscrolls the display (and
+// redraws it the way it showed), so panes can be opened over it
+void vt100_close(vt100_t *t);
+#endif
+// the same as the functions above for terminal t
+void vt100_term_putc(vt100_t *t, uint8_t ch);
+void vt100_term_puts(vt100_t *t, const char *str);
+size_t vt100_term_write(vt100_t *t, const uint8_t *buf, size_t len);
+uint8_t vt100_term_flush(vt100_t *t, uint8_t max_steps);
+// draws what changed on all terminals. They share the display, so they take
+// turns one step at a time, starting after the one that went last in the
+// previous call. Returns the number of rows still waiting on all of them
+uint8_t vt100_flush_all(uint8_t max_steps);
+
+#if VT100_STATS
+// counters kept in builds with VT100_STATS (the host benchmark)
+struct vt100_stats {
+	uint32_t glyphs; // printable characters stored into the screen
+	uint32_t elided; // of those, the ones the screen already showed
+};
+extern struct vt100_stats vt100_stats;
+#endif
 
 #ifdef __cplusplus
 }